@@ -1,18 +1,24 @@
 #ifndef __RBTREE_HPP_INCLUDED
 #define __RBTREE_HPP_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cstddef>
+#include <exception>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <memory>
 #include <type_traits>
 #include <utility>
-template <typename, typename, typename>
+#include <vector>
+template <typename, typename, typename, typename, typename>
 class RBTree;
+#include <RBTreeAugment.hpp>
 #include <RBTreeIterator.hpp>
 #include <RBTreeNode.hpp>
-#include <RBTreeNodePointer.hpp>
+#include <RBTreeNodeHandle.hpp>
 
 #ifndef NDEBUG
 #include <queue>
@@ -20,22 +26,40 @@ class RBTree;
 //#include <vector>
 #endif
 
-template <typename T, typename Compare = std::less<T>, typename Enable = void>
+// tag: the range is already sorted and free of duplicates
+struct RBTreeSortedUnique {};
+constexpr RBTreeSortedUnique sorted_unique {};
+
+template <typename T, typename Compare = std::less<T>, 
+          typename Allocator = std::allocator<T>, 
+          typename Augment = RBTreeNoAugment, typename Enable = void>
 class RBTree;
-template <typename T, typename Compare>
-std::ostream& operator<<(std::ostream &, const RBTree<T, Compare> &);
+template <typename T, typename Compare, typename Allocator, typename Augment>
+std::ostream& operator<<(std::ostream &, 
+                         const RBTree<T, Compare, Allocator, Augment> &);
+// needs the defaults above
+#include <RBTreeFrozen.hpp>
 
-template <typename T, typename Compare>
-class RBTree<T, Compare, 
+// Augment folds every subtree into an aggregate kept in its root, see
+// RBTreeAugment.hpp; the default keeps nothing
+template <typename T, typename Compare, typename Allocator, typename Augment>
+class RBTree<T, Compare, Allocator, Augment,
       typename std::enable_if<std::is_assignable<T&, T>::value
       && !std::is_reference<T>::value>::type> {
 
-  using Node = RBTreeNode<T>;
-  using pNode = std::shared_ptr<Node>;
-  using cNode = std::shared_ptr<const Node>;
-  using wNode = RBTreeNodePointer<T>;
+  using Node = RBTreeNode<T, Augment>;
+  using pNode = Node*;
+  using cNode = const Node*;
+  using node_allocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<Node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+  static_assert(std::is_same<typename node_traits::pointer, pNode>::value,
+      "fancy allocator pointers are not supported");
 
   friend std::ostream& operator<< <> (std::ostream &, const RBTree &);
+  // walks the nodes and their aggregates
+  template <typename, typename, typename>
+  friend class RBTreeIntervalTree;
 #ifndef NDEBUG
   friend void testInsertion();
 #endif
@@ -47,34 +71,72 @@ public:
 // member types
   using value_type = T;
   using value_compare = Compare;
+  using allocator_type = Allocator;
   using reference = value_type&;
   using const_reference = const value_type&;
-  using iterator = RBTreeIterator<const T>;
-  using const_iterator = RBTreeIterator<const T>;
+  using iterator = RBTreeIterator<const T, Augment>;
+  using const_iterator = RBTreeIterator<const T, Augment>;
   using reverse_iterator = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
   using size_type = std::size_t;
   using difference_type = typename iterator::difference_type;
+  using node_type = RBTreeNodeHandle<T, Allocator, Augment>;
+  using augment_type = Augment;
+  using aggregate_type = typename Augment::aggregate_type;
+  struct insert_return_type {
+    iterator position;
+    bool inserted;
+    node_type node;
+  };
+  // outcome of each key of apply_batch, in the order given
+  struct batch_result {
+    std::vector<bool> inserted;
+    std::vector<bool> erased;
+  };
   
 ///////////////////////////////////////////////////////////////////////////////
 // ctor
-  explicit RBTree(const Compare& comp = Compare()) : _comp(comp) {}
+  explicit RBTree(const Compare& comp = Compare(), 
+                  const Allocator& alloc = Allocator())
+    : _comp(comp), _alloc(alloc) {}
+  explicit RBTree(const Allocator& alloc) : _alloc(alloc) {}
   template <class InputIt>
-  RBTree( InputIt first, InputIt last, const Compare& comp = Compare())
-    : _comp(comp) {
-    insert(first, last);
+  RBTree( InputIt first, InputIt last, const Compare& comp = Compare(),
+          const Allocator& alloc = Allocator())
+    : _comp(comp), _alloc(alloc) {
+    try {
+      assign_range(first, last, typename 
+          std::iterator_traits<InputIt>::iterator_category());
+    } catch (...) {
+      clear();
+      throw;
+    }
   }
-  RBTree(const RBTree &other) 
-    : _root(copy_node(other._root)), _comp(other._comp) {
-    build_prev_next(_root);
-    build_begin(_root);
-    build_end(_root);
+  // O(n) bulk load, [first, last) must be sorted by comp without duplicates
+  template <class ForwardIt>
+  RBTree( RBTreeSortedUnique, ForwardIt first, ForwardIt last, 
+          const Compare& comp = Compare(), 
+          const Allocator& alloc = Allocator())
+    : _comp(comp), _alloc(alloc) {
+    try {
+      build_sorted(first, std::distance(first, last));
+    } catch (...) {
+      clear();
+      throw;
+    }
   }
-  RBTree(RBTree &&other) noexcept {this->swap(other);}
+  RBTree(const RBTree &other) 
+    : RBTree(other, node_traits::select_on_container_copy_construction(
+          other._alloc)) {}
+  RBTree(const RBTree &other, const Allocator& alloc) 
+    : RBTree(other, node_allocator(alloc)) {}
+  RBTree(RBTree &&other) noexcept 
+    : _comp(other._comp), _augment(other._augment), _alloc(other._alloc) 
+  {this->swap(other);}
 
 ///////////////////////////////////////////////////////////////////////////////
 // dtor
-  ~RBTree() noexcept {}
+  ~RBTree() noexcept {clear();}
 
 ///////////////////////////////////////////////////////////////////////////////
 // operator=
@@ -85,6 +147,10 @@ public:
   }
   RBTree &operator=(RBTree &&other) noexcept {
     this->swap(other); return *this;}
+
+///////////////////////////////////////////////////////////////////////////////
+// allocator
+  allocator_type get_allocator() const {return allocator_type(_alloc);}
   
 ///////////////////////////////////////////////////////////////////////////////
 // iterators
@@ -92,8 +158,10 @@ public:
   const_iterator root() const noexcept {return _root;}
 
   iterator begin() noexcept {return _begin;}
+  const_iterator begin() const noexcept {return _begin;}
   const_iterator cbegin() const noexcept {return _begin;}
   iterator end() noexcept {return _end;}
+  const_iterator end() const noexcept {return _end;}
   const_iterator cend() const noexcept {return _end;}
   reverse_iterator rbegin() noexcept 
   {return std::make_reverse_iterator(end());}
@@ -111,85 +179,145 @@ public:
 
 ///////////////////////////////////////////////////////////////////////////////
 // modifiers
+  // O(n) without recursion; O(chunks) when the nodes need no destructor
+  // and the allocator can drop all it handed out, see release_nodes
   void clear() noexcept {
+    if (!release_nodes(_alloc, 0)) {
+      destroy_subtree(_root);
+      if (_end) destroy_node(_end);
+    }
     _begin = _root = _end = nullptr;
     _size = 0;
   }
 
   std::pair<iterator, bool> insert(const_reference value) {
-    pNode parent;
+    pNode parent = nullptr;
     auto find_result = find(_root, value, parent);
     if (find_result.second) return {find_result.first, false};
-    pNode inserted = find_result.first = std::make_shared<Node>(value);
-    inserted->parent() = parent;
-    if (inserted->is_root()) {
-      _begin = _root = inserted;
-      _root->next() = _end = std::make_shared<Node>();
-      _end->prev() = _root;
-    } else {
-      if (parent->left() == inserted) {
-        if (parent->prev()) parent->prev()->next() = inserted;
-        else _begin = inserted;
-        inserted->prev() = parent->prev();
-        parent->prev() = inserted;
-        inserted->next() = parent;
-      } else {
-        parent->next()->prev() = inserted;
-        inserted->next() = parent->next();
-        parent->next() = inserted;
-        inserted->prev() = parent;
-      }
-    }
-    insert_repair_tree(inserted);
-    ++_size;
-    return {inserted, true};
+    return {link_node(parent, find_result.first, create_value_node(value)), 
+            true};
   }
 
-  template <class InputIt>
-  void insert( InputIt first, InputIt last ) {
-    while (first != last) insert(*first++);
+  std::pair<iterator, bool> insert(value_type &&value) {
+    pNode parent = nullptr;
+    auto find_result = find(_root, value, parent);
+    if (find_result.second) return {find_result.first, false};
+    return {link_node(parent, find_result.first, 
+                      create_value_node(std::move(value))), true};
   }
 
-  iterator erase(iterator pos) {
-    pNode p = std::const_pointer_cast<Node>(pos.lock());
+  // no search when value belongs right before or after hint, but still
+  // O(log n): the subtree sizes and aggregates are updated up to the root
+  iterator insert(const_iterator hint, const_reference value) {
+    pNode parent = nullptr;
+    pNode *link = hint_link(hint.node(), value, parent);
+    if (!link) return insert(value).first;
+    return link_node(parent, *link, create_value_node(value));
+  }
 
-    //assert(p)
-    // prev/next
-    wNode next = p->next();
-    next->prev() = p->prev();
-    (p->prev()?p->prev()->next():_begin) = next;
+  iterator insert(const_iterator hint, value_type &&value) {
+    pNode parent = nullptr;
+    pNode *link = hint_link(hint.node(), value, parent);
+    if (!link) return insert(std::move(value)).first;
+    return link_node(parent, *link, create_value_node(std::move(value)));
+  }
 
-    // empty()
-    if (_begin == _end) {clear(); return end();}
+  // nh must come from a tree whose allocator compares equal
+  insert_return_type insert(node_type &&nh) {
+    if (nh.empty()) return {end(), false, node_type()};
+    assert(nh._alloc == _alloc);
+    pNode parent = nullptr;
+    auto find_result = find(_root, nh.value(), parent);
+    if (find_result.second) 
+      return {find_result.first, false, std::move(nh)};
+    create_end();
+    return {link_node(parent, find_result.first, nh.release()), true, 
+            node_type()};
+  }
 
-    if (p->leaf_child_count() == 0) {
-      swap_but_value_prev_next(p, p->prev().lock());
+  iterator insert(const_iterator hint, node_type &&nh) {
+    if (nh.empty()) return end();
+    assert(nh._alloc == _alloc);
+    pNode parent = nullptr;
+    pNode *link = hint_link(hint.node(), nh.value(), parent);
+    if (!link) return insert(std::move(nh)).position;
+    return link_node(parent, *link, nh.release());
+  }
+
+  template <class InputIt>
+  void insert( InputIt first, InputIt last ) {
+    // sorted runs keep hitting the hint, which saves the comparisons but
+    // not the walk to the root of every insert
+    const_iterator hint = cend();
+    while (first != last) hint = std::next(insert(hint, *first++));
+  }
+
+  // [first, last) must be sorted by comp without duplicates; the
+  // positions of each group of lockstep values are searched for together,
+  // so their cache misses overlap, then each goes in by its hint
+  template <class ForwardIt>
+  void insert(RBTreeSortedUnique, ForwardIt first, ForwardIt last) {
+    // a value is only followed by greater ones, so its hint stays right
+    lower_bound_each(first, last, [this](const_reference value, cNode hint) {
+      if (hint) insert(const_iterator(hint), value);
+      else insert(value);
+    });
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args && ... args) {
+    pNode node = create_value_node(
+        typename Node::in_place_t(), std::forward<Args>(args)...);
+    pNode parent = nullptr;
+    auto find_result = find(_root, node->value(), parent);
+    if (find_result.second) {
+      destroy_node(node);
+      return {find_result.first, false};
     }
-    //assert(check_parent());
-    //assert(p->leaf_child_count() >= 0);
-    
-    if (p->is_red()) {
-      // assert(p->leaf_child_count() == 2);
-      // assert(!p->is_root());
-      p->pointer_to_this() = nullptr;
-    } else {
-      pNode child = p->left()?p->left():p->right();
-      if (child) {
-        //assert(child->is_red());
-        child->parent() = p->parent();
-        child->set_black();
-      } else erase_repair_tree(p);
-      pointer_to_this(p) = child;
-      // p is deleted!
+    return {link_node(parent, find_result.first, node), true};
+  }
+
+  template <class... Args>
+  iterator emplace_hint(const_iterator hint, Args && ... args) {
+    pNode node = create_value_node(
+        typename Node::in_place_t(), std::forward<Args>(args)...);
+    pNode parent = nullptr;
+    pNode *link = hint_link(hint.node(), node->value(), parent);
+    if (!link) {
+      auto find_result = find(_root, node->value(), parent);
+      if (find_result.second) {
+        destroy_node(node);
+        return find_result.first;
+      }
+      link = &find_result.first;
     }
+    return link_node(parent, *link, node);
+  }
 
-    --_size;
+  iterator erase(iterator pos) {
+    pNode p = const_cast<pNode>(pos.node());
+    iterator next = unlink_node(p);
+    destroy_node(p);
     return next;
   }
 
+  // short ranges go one by one; longer ones are cut out with two splits
+  // and a join, O(log n) rebalancing plus O(k) to free them
   iterator erase(const_iterator first, const_iterator last) {
-    while (first != last) erase(first++);
-    return last;
+    const_iterator probe = first;
+    for (size_type k = 0; k != few_erase && probe != last; ++k) ++probe;
+    if (probe == last) {
+      while (first != last) erase(first++);
+      return last;
+    }
+    Piece l, doomed, r;
+    pNode head = split_piece(release_piece(), *first, l, doomed);
+    pNode tail = last == cend() ? nullptr
+      : split_piece(doomed, *last, doomed, r);
+    destroy_node(head);
+    destroy_subtree(doomed.root);
+    install(tail ? join_pieces(l, tail, r) : l);
+    return tail ? iterator_to(tail) : end();
   }
 
   size_type erase(const_reference value) {
@@ -199,6 +327,137 @@ public:
     return 1;
   }
 
+  // take the node out of the tree without reallocating it
+  node_type extract(const_iterator pos) {
+    pNode p = const_cast<pNode>(pos.node());
+    unlink_node(p);
+    reset_node(p);
+    return node_type(p, _alloc);
+  }
+
+  node_type extract(const_reference value) {
+    auto it = find(value);
+    if (it == end()) return node_type();
+    return extract(it);
+  }
+
+  // splice in the nodes of other whose values are not in *this, the
+  // others stay in other; O(m log(n/m + 1)) for sizes m <= n, no
+  // allocation. The allocators must compare equal.
+  void merge(RBTree &other) {
+    assert(_alloc == other._alloc);
+    if (this == &other || other.empty()) return;
+    if (empty()) {
+      swap(other);
+      return;
+    }
+    if (other._size <= _size / few_ratio) {
+      relink_each(other, false);
+      return;
+    }
+    Chain dups;
+    SerialRun run {*this};
+    install(unite(release_piece(), other.release_piece(), &dups, run));
+    Piece rest;
+    pNode next = dups.head;
+    auto make = [&next] {
+      pNode node = next;
+      next = next->next();
+      return node;
+    };
+    other.build_piece(rest, dups.size, make);
+    other.install(rest);
+  }
+  void merge(RBTree &&other) {merge(other);}
+
+  // move out the values not less than value, in O(log n)
+  RBTree split(const_reference value) {
+    // the same node allocator, so the halves can be joined again
+    RBTree right(_comp);
+    right._alloc = _alloc;
+    right._augment = _augment;
+    cNode lower = lower_bound_node(value);
+    if (lower == _end) return right;
+    if (lower == _begin) {
+      right.swap(*this);
+      return right;
+    }
+    right.create_end();
+    Piece l, r;
+    pNode mid = split_piece(release_piece(), value, l, r);
+    if (mid) r = join_pieces(Piece(), mid, r);
+    install(l);
+    right.install(r);
+    return right;
+  }
+
+  // append right, whose values must all be greater than those of *this;
+  // O(log n), right is left empty
+  void join(RBTree &&right) {
+    assert(_alloc == right._alloc);
+    assert(empty() || right.empty() || 
+           _comp(_end->prev()->value(), right._begin->value()));
+    Piece l = release_piece(), r = right.release_piece();
+    if (!_end) std::swap(_end, right._end);
+    install(concat_pieces(l, r));
+    right.install(Piece());
+  }
+
+  // append value and then right; every value of *this < value < every
+  // value of right
+  void join(const_reference value, RBTree &&right) {
+    assert(_alloc == right._alloc);
+    assert(empty() || _comp(_end->prev()->value(), value));
+    assert(right.empty() || _comp(value, right._begin->value()));
+    pNode k = create_value_node(value);
+    install(join_pieces(release_piece(), k, right.release_piece()));
+    right.install(Piece());
+  }
+
+  // erase every value of erases, then insert every value of inserts; a
+  // value given twice counts the first time. Each side is sorted and
+  // visited in order, every search starting from where the last one
+  // ended, so clustered keys cost little more than the rebalancing:
+  // O(m log(n/m + 1)) comparisons for m keys. If an allocation throws,
+  // the updates before it stay.
+  template <class Inserts, class Erases>
+  batch_result apply_batch(const Inserts &inserts, const Erases &erases) {
+    batch_result result;
+    auto order = sort_batch(erases);
+    result.erased.resize(order.size());
+    pNode finger = nullptr;
+    for (const auto &e : order) {
+      if (!_root) break;
+      pNode parent = nullptr;
+      auto found = find(finger_link(finger, *e.first, parent), *e.first,
+                        parent);
+      if (!found.second) {
+        finger = parent;
+        continue;
+      }
+      pNode p = found.first;
+      finger = unlink_node(p);
+      destroy_node(p);
+      result.erased[e.second] = true;
+    }
+
+    order = sort_batch(inserts);
+    result.inserted.resize(order.size());
+    finger = nullptr;
+    for (const auto &e : order) {
+      pNode parent = nullptr;
+      auto found = find(finger_link(finger, *e.first, parent), *e.first,
+                        parent);
+      if (found.second) {
+        finger = found.first;
+        continue;
+      }
+      finger = link_node(parent, found.first, create_value_node(*e.first));
+      result.inserted[e.second] = true;
+    }
+    return result;
+  }
+
   void swap(RBTree &other) noexcept {
     using std::swap;
     swap(_root, other._root);
@@ -206,8 +465,91 @@ public:
     swap(_end, other._end);
     swap(_size, other._size);
     swap(_comp, other._comp);
+    swap(_augment, other._augment);
+    swap(_alloc, other._alloc);
   }
   
+
+///////////////////////////////////////////////////////////////////////////////
+// set operations
+  // These reuse the nodes of both trees in place and leave other empty;
+  // O(m log(n/m + 1)) for sizes m <= n. The allocators must compare equal
+  // and Compare must not throw.
+
+  // keeps the node of *this when both hold a value
+  void set_union(RBTree &&other) {
+    SerialRun run {*this};
+    unite_with(other, run);
+  }
+
+  void set_intersection(RBTree &&other) {
+    assert(_alloc == other._alloc);
+    SerialRun run {*this};
+    install(intersect(release_piece(), other.release_piece(), run));
+    other.install(Piece());
+  }
+
+  void set_difference(RBTree &&other) {
+    assert(_alloc == other._alloc);
+    SerialRun run {*this};
+    install(subtract(release_piece(), other.release_piece(), run));
+    other.install(Piece());
+  }
+
+  // The same, forking the two halves of every step over parallel_grain
+  // nodes onto pool, an RBTreeThreadPool or anything whose fork_join(f, g)
+  // runs both before returning and throws only what they throw.
+  // Compare and Augment are then called from several threads at once;
+  // the allocator only from this one.
+  template <class Pool>
+  void set_union(RBTree &&other, Pool &pool) {
+    ParallelRun<Pool> run {pool};
+    unite_with(other, run);
+    run.free_trash(*this);
+  }
+
+  template <class Pool>
+  void set_intersection(RBTree &&other, Pool &pool) {
+    assert(_alloc == other._alloc);
+    ParallelRun<Pool> run {pool};
+    install(intersect(release_piece(), other.release_piece(), run));
+    other.install(Piece());
+    run.free_trash(*this);
+  }
+
+  template <class Pool>
+  void set_difference(RBTree &&other, Pool &pool) {
+    assert(_alloc == other._alloc);
+    ParallelRun<Pool> run {pool};
+    install(subtract(release_piece(), other.release_piece(), run));
+    other.install(Piece());
+    run.free_trash(*this);
+  }
+
+  // a copy whose nodes are all allocated here first, then filled and
+  // linked by subtree on pool; values and aggregates are copied from
+  // several threads at once
+  template <class Pool>
+  RBTree clone(Pool &pool) const {
+    RBTree result(_comp);
+    result._augment = _augment;
+    result._alloc = node_traits::select_on_container_copy_construction(
+        _alloc);
+    try {
+      result.copy_tree(*this, pool);
+    } catch (...) {
+      result.clear();
+      throw;
+    }
+    return result;
+  }
+
+  // an immutable copy in one array, faster to search, see RBTreeFrozen.hpp
+  RBTreeFrozen<T, Compare, Allocator> freeze() const {
+    return RBTreeFrozen<T, Compare, Allocator>(
+        sorted_unique, cbegin(), cend(), _comp, get_allocator());
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 // lookup
   iterator find(const_reference value) {
@@ -215,14 +557,157 @@ public:
     return rtn.second ? rtn.first : end();
   }
 
-  //const_iterator find(const_reference value) const {
-  //  auto rtn = find(_root, value);
-  //  return rtn.second ? rtn.first : cend();
-  //}
+  const_iterator find(const_reference value) const {
+    cNode curr = lower_bound_node(value);
+    return curr != _end && !_comp(value, curr->value()) ? curr : _end;
+  }
+
+  size_type count(const_reference value) const {
+    return find(value) != cend();
+  }
+
+  bool contains(const_reference value) const {
+    return find(value) != cend();
+  }
+
+  iterator lower_bound(const_reference value) {
+    return lower_bound_node(value);
+  }
+  const_iterator lower_bound(const_reference value) const {
+    return lower_bound_node(value);
+  }
+
+  iterator upper_bound(const_reference value) {
+    return upper_bound_node(value);
+  }
+  const_iterator upper_bound(const_reference value) const {
+    return upper_bound_node(value);
+  }
+
+  std::pair<iterator, iterator> equal_range(const_reference value) {
+    return static_cast<const RBTree&>(*this).equal_range(value);
+  }
+  std::pair<const_iterator, const_iterator> 
+    equal_range(const_reference value) const {
+    cNode lower = lower_bound_node(value);
+    if (lower == _end || _comp(value, lower->value())) 
+      return {lower, lower};
+    return {lower, lower->next()};
+  }
+
+  // find(value) for each value of [first, last) in turn, written to out;
+  // the descents of lockstep values at a time run together, so on a tree
+  // too big for the cache their misses overlap instead of queueing
+  template <class ForwardIt, class OutputIt>
+  OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const {
+    lower_bound_each(first, last, [this, &out](const_reference value,
+                                               cNode lower) {
+      *out++ = const_iterator(matches(lower, value) ? lower : _end);
+    });
+    return out;
+  }
+
+  // contains(value) for each value of [first, last), as find_many
+  template <class ForwardIt, class OutputIt>
+  OutputIt contains_many(ForwardIt first, ForwardIt last,
+                         OutputIt out) const {
+    lower_bound_each(first, last, [this, &out](const_reference value,
+                                               cNode lower) {
+      *out++ = matches(lower, value);
+    });
+    return out;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// order statistics
+  // k-th smallest element (0-based), end() if k >= size()
+  iterator nth(size_type k) {
+    return static_cast<const RBTree&>(*this).nth(k);
+  }
+  const_iterator nth(size_type k) const {
+    if (k >= _size) return cend();
+    cNode curr = _root;
+    while (true) {
+      size_type left = size_of(curr->left());
+      if (k < left) curr = curr->left();
+      else if (k == left) return curr;
+      else {
+        k -= left + 1;
+        curr = curr->right();
+      }
+    }
+  }
+
+  // number of elements less than value
+  size_type rank(const_reference value) const {
+    size_type result = 0;
+    cNode curr = _root;
+    while (curr) {
+      if (_comp(curr->value(), value)) {
+        result += size_of(curr->left()) + 1;
+        curr = curr->right();
+      } else curr = curr->left();
+    }
+    return result;
+  }
+
+  // position of pos in the sequence, size() for end()
+  size_type index_of(const_iterator pos) const {
+    cNode curr = pos.node();
+    if (curr == _end) return _size;
+    size_type result = size_of(curr->left());
+    for (; curr->parent(); curr = curr->parent())
+      if (curr->parent()->right() == curr)
+        result += size_of(curr->parent()->left()) + 1;
+    return result;
+  }
+
+  difference_type distance(const_iterator first, const_iterator last) const {
+    return static_cast<difference_type>(index_of(last)) - 
+           static_cast<difference_type>(index_of(first));
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// aggregates
+  // fold of every element, identity() if empty
+  aggregate_type aggregate() const {return aggregate_of(_root);}
+
+  // fold of the elements in [lo, hi), O(log n)
+  aggregate_type aggregate(const_reference lo, const_reference hi) const {
+    // the topmost node inside the range splits it into two spines
+    cNode split = _root;
+    while (split) {
+      if (_comp(split->value(), lo)) split = split->right();
+      else if (!_comp(split->value(), hi)) split = split->left();
+      else break;
+    }
+    if (!split) return _augment.identity();
+    aggregate_type left = _augment.identity();
+    for (cNode curr = split->left(); curr; ) {
+      if (_comp(curr->value(), lo)) curr = curr->right();
+      else {
+        left = _augment.combine(_augment.combine(
+              _augment.lift(curr->value()), aggregate_of(curr->right())), 
+            left);
+        curr = curr->left();
+      }
+    }
+    aggregate_type right = _augment.identity();
+    for (cNode curr = split->right(); curr; ) {
+      if (_comp(curr->value(), hi)) {
+        right = _augment.combine(right, _augment.combine(
+              aggregate_of(curr->left()), _augment.lift(curr->value())));
+        curr = curr->right();
+      } else curr = curr->left();
+    }
+    return _augment.combine(_augment.combine(
+          left, _augment.lift(split->value())), right);
+  }
   
 ///////////////////////////////////////////////////////////////////////////////
 // observers
 value_compare value_comp() const {return _comp;}
+augment_type augment() const {return _augment;}
 
 #ifndef NDEBUG
 ///////////////////////////////////////////////////////////////////////////////
@@ -254,8 +739,8 @@ value_compare value_comp() const {return _comp;}
           result += tmp;
           nq.emplace(++(i<<=1), p->left());
           nq.emplace(++i, p->right());
-          if (p->left()) assert(p->left()->parent().lock() == p);
-          if (p->right()) assert(p->right()->parent().lock() == p);
+          if (p->left()) assert(p->left()->parent() == p);
+          if (p->right()) assert(p->right()->parent() == p);
       } else
           result += "nul,";
     }
@@ -270,16 +755,8 @@ value_compare value_comp() const {return _comp;}
 
   bool is_valid_rb_tree() const {
     return is_black(_root) && check_reds_children(_root)
-      && check_black_height(_root).second;
-  }
-
-  template <typename Y>
-  static bool is_red(Y n) {
-    return n && n->is_red();
-  }
-  template <typename Y>
-  static bool is_black(Y n) {
-    return !is_red(n);
+      && check_black_height(_root).second && check_size(_root).second
+      && check_aggregate(_root);
   }
 
   //int is_valid() const {
@@ -297,76 +774,777 @@ value_compare value_comp() const {return _comp;}
 #endif  //NDEBUG
 
 private:
-  pNode _root; // store above root instead of root?
-  wNode _begin; // maybe _rend should not be _end
-  pNode _end;
+  pNode _root = nullptr; // store above root instead of root?
+  pNode _begin = nullptr; // maybe _rend should not be _end
+  pNode _end = nullptr;
   size_type _size = 0;
   Compare _comp;
+  Augment _augment;
+  node_allocator _alloc;
+
+  // A piece is a detached subtree: a valid red-black tree whose root may be
+  // red, with its first and last node and its black height. prev/next are
+  // right between its own nodes, first->prev and last->next are garbage
+  // until the piece is joined or installed.
+  struct Piece {
+    pNode root = nullptr;
+    pNode first = nullptr;
+    pNode last = nullptr;
+    size_type bh = 0; // black nodes from root down to a leaf
+  };
+
+  // duplicates set aside in order, chained through next
+  struct Chain {
+    pNode head = nullptr;
+    pNode *tail = &head;
+    size_type size = 0;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+// node allocation
+  template <typename... Args>
+  pNode create_node(Args && ... args) {
+    pNode p = node_traits::allocate(_alloc, 1);
+    try {
+      node_traits::construct(_alloc, p, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(_alloc, p, 1);
+      throw;
+    }
+    return p;
+  }
+
+  // a node for the tree, plus _end if this is the first one
+  template <typename... Args>
+  pNode create_value_node(Args && ... args) {
+    pNode node = create_node(std::forward<Args>(args)...);
+    try {
+      create_end();
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    return node;
+  }
+
+  void create_end() {
+    if (!_end) _end = create_node();
+  }
+
+  // back to the state of a fresh node, the value aside
+  static void reset_node(pNode p) noexcept {
+    p->left() = p->right() = p->parent() = nullptr;
+    p->prev() = p->next() = nullptr;
+    p->size() = 1;
+    p->set_red();
+  }
+
+  void destroy_node(pNode p) noexcept {
+    node_traits::destroy(_alloc, p);
+    node_traits::deallocate(_alloc, p, 1);
+  }
+
+  // dtor/clear: the tree owns every node below _root; left children are
+  // rotated up until there are none, so no stack is needed
+  void destroy_subtree(pNode curr) noexcept {
+    while (curr) {
+      pNode left = curr->left();
+      if (left) {
+        curr->left() = left->right();
+        left->right() = curr;
+        curr = left;
+      } else {
+        pNode right = curr->right();
+        destroy_node(curr);
+        curr = right;
+      }
+    }
+  }
+
+  // an allocator like RBTreePoolAllocator frees all its blocks at once if
+  // no other tree, node handle or copy shares it; only worth it when no
+  // node needs its destructor run
+  template <class A>
+  static auto release_nodes(A &alloc, int) noexcept
+    -> decltype(alloc.release(), bool(alloc.exclusive())) {
+    if (!std::is_trivially_destructible<Node>::value || !alloc.exclusive())
+      return false;
+    alloc.release();
+    return true;
+  }
+  template <class A>
+  static bool release_nodes(A &, long) noexcept {return false;}
 
 ///////////////////////////////////////////////////////////////////////////////
 // copy ctor
-  static pNode copy_node(cNode src) {
-    if (src == nullptr) return nullptr;
-    pNode dest = std::make_shared<Node>(src->value());
+  RBTree(const RBTree &other, const node_allocator &alloc) 
+    : _comp(other._comp), _augment(other._augment), _alloc(alloc) {
+    try {
+      copy_tree(other);
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  // one pass over other in order, using its parent links instead of a
+  // stack; each copy is hung under its parent's copy on the way down and
+  // threaded after the last one when its left subtree is done
+  void copy_tree(const RBTree &other) {
+    if (!other._root) return;
+    reserve_nodes(_alloc, other._size + 1, 0);
+    create_end();
+    cNode s = other._root;
+    pNode d = _root = copy_node(s);
+    pNode last = nullptr;
+    enum {from_parent, from_left, from_right} from = from_parent;
+    while (d) {
+      if (from == from_parent && s->left()) {
+        d->left() = copy_node(s->left());
+        d->left()->parent() = d;
+        s = s->left();
+        d = d->left();
+        continue;
+      }
+      if (from != from_right) {
+        d->prev() = last;
+        (last ? last->next() : _begin) = d;
+        last = d;
+        if (s->right()) {
+          d->right() = copy_node(s->right());
+          d->right()->parent() = d;
+          s = s->right();
+          d = d->right();
+          from = from_parent;
+          continue;
+        }
+      }
+      from = s->parent() && s->parent()->left() == s ? from_left
+                                                      : from_right;
+      s = s->parent();
+      d = d->parent();
+    }
+    last->next() = _end;
+    _end->prev() = last;
+    _size = other._size;
+  }
+
+  // the copy of the node of rank r in order goes to slots[r], so every
+  // node knows its neighbours and children without waiting for them
+  struct Copy {
+    std::vector<pNode> slots;
+    std::vector<char> built;
+    std::atomic<bool> failed {false};
+    std::exception_ptr error;
+  };
+
+  template <class Pool>
+  void copy_tree(const RBTree &other, Pool &pool) {
+    if (!other._root) return;
+    size_type n = other._size;
+    reserve_nodes(_alloc, n + 1, 0);
+    create_end();
+    Copy copy;
+    copy.slots.reserve(n);
+    copy.built.resize(n);
+    try {
+      while (copy.slots.size() != n)
+        copy.slots.push_back(node_traits::allocate(_alloc, 1));
+    } catch (...) {
+      for (pNode p : copy.slots) node_traits::deallocate(_alloc, p, 1);
+      throw;
+    }
+    ParallelRun<Pool> run {pool};
+    pNode root = copy_ranked(other._root, 0, nullptr, copy, run);
+    if (copy.failed) {
+      for (size_type r = 0; r != n; ++r) {
+        if (copy.built[r]) node_traits::destroy(_alloc, copy.slots[r]);
+        node_traits::deallocate(_alloc, copy.slots[r], 1);
+      }
+      std::rethrow_exception(copy.error);
+    }
+    _root = root;
+    _begin = copy.slots.front();
+    _end->prev() = copy.slots.back();
+    _size = n;
+  }
+
+  // copy src's subtree, whose first node has rank offset; null if the
+  // copy failed before this node was linked, which copy_tree cleans up
+  template <class Run>
+  pNode copy_ranked(cNode src, size_type offset, pNode parent, Copy &copy,
+                    Run &run) noexcept {
+    if (copy.failed.load(std::memory_order_relaxed)) return nullptr;
+    size_type rank = offset + size_of(src->left());
+    pNode dest = copy.slots[rank];
+    try {
+      node_traits::construct(_alloc, dest, src->value());
+      copy.built[rank] = 1;
+      dest->aggregate() = src->aggregate();
+    } catch (...) {
+      if (!copy.failed.exchange(true)) copy.error = std::current_exception();
+      return nullptr;
+    }
     dest->color() = src->color();
-    dest->left() = copy_node(src->left());
-    dest->right() = copy_node(src->right());
-    if (dest->left()) dest->left()->parent() = dest;
-    if (dest->right()) dest->right()->parent() = dest;
+    dest->size() = src->size();
+    dest->parent() = parent;
+    dest->prev() = rank ? copy.slots[rank - 1] : nullptr;
+    dest->next() = rank + 1 != copy.slots.size() ? copy.slots[rank + 1]
+                                                 : _end;
+    pNode left = nullptr, right = nullptr;
+    run.fork(src->size(), [&] {
+      if (src->left())
+        left = copy_ranked(src->left(), offset, dest, copy, run);
+    }, [&] {
+      if (src->right())
+        right = copy_ranked(src->right(), rank + 1, dest, copy, run);
+    });
+    dest->left() = left;
+    dest->right() = right;
     return dest;
   }
 
-  // build prev and next pointers, and size
-  void build_prev_next(pNode curr) {
-    // assume all prev and next starts at nullptr
-    if (curr == nullptr) return;
-    ++_size;
-    if (curr->left()) {
-      if (curr->prev()) curr->prev()->next() = curr->left();
-      curr->left()->prev() = curr->prev();
-      curr->left()->next() = curr;
-      curr->prev() = curr->left();
-    }
-    if (curr->right()) {
-      if (curr->next()) curr->next()->prev() = curr->right();
-      curr->right()->next() = curr->next();
-      curr->right()->prev() = curr;
-      curr->next() = curr->right();
-    }
-    build_prev_next(curr->left());
-    build_prev_next(curr->right());
-  }
-
-  void build_begin(pNode curr) {
-    // assume _begin starts at nullptr
-    if (!curr) return;
-    _begin = curr;
-    build_begin(curr->left());
-  }
-
-  void build_end(pNode curr) {
-    // assume _begin starts at nullptr
-    if (!curr) return;
-    if (!curr->next()) {
-      curr->next() = _end = std::make_shared<Node>();
-      _end->prev() = curr;
+  // the node alone, unlinked
+  pNode copy_node(cNode src) {
+    pNode dest = create_node(src->value());
+    try {
+      dest->aggregate() = src->aggregate();
+    } catch (...) {
+      destroy_node(dest);
+      throw;
+    }
+    dest->color() = src->color();
+    dest->size() = src->size();
+    return dest;
+  }
+
+  // ask allocators that can, like RBTreePoolAllocator, for n nodes at once
+  template <class A>
+  static auto reserve_nodes(A &alloc, size_type n, int)
+    -> decltype(alloc.reserve(n), void()) {alloc.reserve(n);}
+  template <class A>
+  static void reserve_nodes(A &, size_type, long) {}
+
+///////////////////////////////////////////////////////////////////////////////
+// range ctor
+  template <class InputIt>
+  void assign_range(InputIt first, InputIt last, std::input_iterator_tag) {
+    insert(first, last);
+  }
+
+  template <class ForwardIt>
+  void assign_range(ForwardIt first, ForwardIt last, 
+                    std::forward_iterator_tag) {
+    auto unsorted = std::adjacent_find(first, last, 
+        [this](const_reference lhs, const_reference rhs) 
+        {return !_comp(lhs, rhs);});
+    if (unsorted == last) build_sorted(first, std::distance(first, last));
+    else insert(first, last);
+  }
+
+  // build a perfectly balanced tree of the n values from first in one
+  // in-order pass, threading prev/next as nodes are created;
+  // the tree must be empty
+  template <class ForwardIt>
+  void build_sorted(ForwardIt first, size_type n) {
+    if (n == 0) return;
+    _end = create_node();
+    Piece p;
+    auto make = [this, &first] {
+      pNode node = create_node(*first);
+      ++first;
+      return node;
+    };
+    try {
+      build_piece(p, n, make);
+    } catch (...) {
+      while (p.last) {
+        pNode prev = p.last->prev();
+        destroy_node(p.last);
+        p.last = prev;
+      }
+      throw;
+    }
+    install(p);
+  }
+
+  // p becomes a balanced piece of the n nodes make() returns in order;
+  // p.last is the latest node threaded so far, even if make() throws
+  template <class Make>
+  void build_piece(Piece &p, size_type n, Make &make) {
+    if (n == 0) return;
+    // levels [0, red_depth) are full and black, 
+    // the rest of the nodes sit on level red_depth and are red
+    size_type red_depth = 0;
+    while ((size_type(2) << red_depth) <= n + 1) ++red_depth;
+    p.root = build_piece(p, n, 0, red_depth, make);
+    p.bh = red_depth;
+  }
+
+  template <class Make>
+  pNode build_piece(Piece &p, size_type n, size_type depth, 
+                    size_type red_depth, Make &make) {
+    if (n == 0) return nullptr;
+    size_type left_size = (n - 1) / 2;
+    pNode left = build_piece(p, left_size, depth + 1, red_depth, make);
+    pNode curr = make();
+    curr->prev() = p.last;
+    if (p.last) p.last->next() = curr;
+    else p.first = curr;
+    p.last = curr;
+    if (depth < red_depth) curr->set_black();
+    else curr->set_red();
+    curr->parent() = nullptr;
+    curr->left() = left;
+    if (left) left->parent() = curr;
+    curr->right() = build_piece(p, n - 1 - left_size, depth + 1, 
+                                red_depth, make);
+    if (curr->right()) curr->right()->parent() = curr;
+    update(curr);
+    return curr;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// join/split
+  // below _size / few_ratio nodes, moving them one by one beats
+  // splitting and joining
+  static constexpr size_type few_ratio = 64;
+  // ranges this short are cheaper to erase one by one
+  static constexpr size_type few_erase = 128;
+
+  // move every node of other whose value is not in *this over by a plain
+  // search and link_node; the duplicates stay in other, or are freed
+  // if consume, which empties other without unlinking anything from it
+  void relink_each(RBTree &other, bool consume) {
+    for (pNode p = other._begin; p && p != other._end; ) {
+      pNode parent = nullptr;
+      auto find_result = find(_root, p->value(), parent);
+      pNode next = p->next();
+      if (find_result.second) {
+        if (consume) destroy_node(p);
+        p = next;
+        continue;
+      }
+      if (!consume) next = other.unlink_node(p);
+      reset_node(p);
+      link_node(parent, find_result.first, p);
+      p = next;
+    }
+    if (consume) {
+      other._root = nullptr;
+      other.install(Piece());
+    }
+  }
+
+  // set_union, serial or parallel as run says
+  template <class Run>
+  void unite_with(RBTree &other, Run &run) {
+    assert(_alloc == other._alloc);
+    if (empty()) swap(other);
+    if (other._size <= _size / few_ratio) {
+      relink_each(other, true);
       return;
     }
-    build_end(curr->right());
+    install(unite(release_piece(), other.release_piece(), nullptr, run));
+    other.install(Piece());
+  }
+
+  static size_type black_height(cNode n) noexcept {
+    size_type h = 0;
+    for (; n; n = n->left()) h += n->is_black();
+    return h;
+  }
+
+  // the whole tree as a piece; *this is left empty but keeps _end
+  Piece release_piece() noexcept {
+    Piece p;
+    if (!_root) return p;
+    p.root = _root;
+    p.first = _begin;
+    p.last = _end->prev();
+    p.bh = black_height(_root);
+    _root = _begin = nullptr;
+    _size = 0;
+    return p;
+  }
+
+  // make p the whole tree; _end is reused, and freed if p is empty
+  void install(Piece p) noexcept {
+    _root = p.root;
+    if (!_root) {
+      if (_end) destroy_node(_end);
+      _begin = _end = nullptr;
+      _size = 0;
+      return;
+    }
+    _root->parent() = nullptr;
+    _root->set_black();
+    _begin = p.first;
+    _begin->prev() = nullptr;
+    p.last->next() = _end;
+    _end->prev() = p.last;
+    _size = _root->size();
+  }
+
+  // cut the root of p off its children; the root is left dangling
+  static void expose(Piece p, Piece &l, Piece &r) noexcept {
+    pNode x = p.root;
+    size_type bh = p.bh - x->is_black();
+    l = r = Piece();
+    if (x->left()) {
+      l = {x->left(), p.first, x->prev(), bh};
+      l.root->parent() = nullptr;
+    }
+    if (x->right()) {
+      r = {x->right(), x->next(), p.last, bh};
+      r.root->parent() = nullptr;
+    }
+    x->left() = x->right() = nullptr;
+  }
+
+  // every value of l < k < every value of r; O(|bh(l) - bh(r)| + 1)
+  Piece join_pieces(Piece l, pNode k, Piece r) noexcept {
+    k->left() = k->right() = k->parent() = nullptr;
+    k->set_red();
+    k->prev() = l.last;
+    if (l.last) l.last->next() = k;
+    k->next() = r.first;
+    if (r.first) r.first->prev() = k;
+    Piece result;
+    result.first = l.root ? l.first : k;
+    result.last = r.root ? r.last : k;
+    if (is_red(l.root)) {
+      l.root->set_black();
+      ++l.bh;
+    }
+    if (is_red(r.root)) {
+      r.root->set_black();
+      ++r.bh;
+    }
+
+    if (l.bh == r.bh) {
+      k->left() = l.root;
+      if (l.root) l.root->parent() = k;
+      k->right() = r.root;
+      if (r.root) r.root->parent() = k;
+      update(k);
+      result.root = k;
+      result.bh = l.bh;
+      return result;
+    }
+    // hang k in place of the first black node on the facing spine of the
+    // taller piece whose black height matches the shorter one, then fix
+    // the red k like an insertion
+    pNode parent = nullptr;
+    if (l.bh > r.bh) {
+      pNode c = l.root;
+      for (size_type h = l.bh; !(is_black(c) && h == r.bh); c = c->right()) {
+        h -= c->is_black();
+        parent = c;
+      }
+      k->left() = c;
+      if (c) c->parent() = k;
+      k->right() = r.root;
+      if (r.root) r.root->parent() = k;
+      parent->right() = k;
+      result.root = l.root;
+      result.bh = l.bh;
+    } else {
+      pNode c = r.root;
+      for (size_type h = r.bh; !(is_black(c) && h == l.bh); c = c->left()) {
+        h -= c->is_black();
+        parent = c;
+      }
+      k->right() = c;
+      if (c) c->parent() = k;
+      k->left() = l.root;
+      if (l.root) l.root->parent() = k;
+      parent->left() = k;
+      result.root = r.root;
+      result.bh = r.bh;
+    }
+    k->parent() = parent;
+    update(k);
+    update_path(parent);
+    result.bh += insert_repair_tree(k, result.root);
+    return result;
+  }
+
+  // every value of l < every value of r
+  Piece concat_pieces(Piece l, Piece r) noexcept {
+    if (!l.root) return r;
+    if (!r.root) return l;
+    pNode last = l.last;
+    Piece rest, none;
+    split_piece(l, last->value(), rest, none);
+    return join_pieces(rest, last, r);
+  }
+
+  // l gets the values less than value, r the greater ones; returns the
+  // node equal to value, detached, or nullptr
+  pNode split_piece(Piece p, const_reference value, 
+                    Piece &l, Piece &r) noexcept {
+    if (!p.root) {
+      l = r = Piece();
+      return nullptr;
+    }
+    pNode x = p.root;
+    Piece xl, xr;
+    expose(p, xl, xr);
+    if (_comp(value, x->value())) {
+      pNode mid = split_piece(xl, value, l, r);
+      r = join_pieces(r, x, xr);
+      return mid;
+    }
+    if (_comp(x->value(), value)) {
+      pNode mid = split_piece(xr, value, l, r);
+      l = join_pieces(xl, x, l);
+      return mid;
+    }
+    l = xl;
+    r = xr;
+    return x;
+  }
+
+  // runs both halves of a set operation in turn and frees nodes at once
+  struct SerialRun {
+    template <class F, class G>
+    void fork(size_type, F &&f, G &&g) noexcept {
+      f();
+      g();
+    }
+    void discard(pNode n) noexcept {tree.destroy_subtree(n);}
+    RBTree &tree;
+  };
+
+  // hands halves of parallel_grain nodes or more to pool; the nodes to
+  // free are stacked and only freed once all tasks are done, so the
+  // allocator is never called from two threads
+  template <class Pool>
+  struct ParallelRun {
+    template <class F, class G>
+    void fork(size_type n, F &&f, G &&g) noexcept {
+      // f and g do not throw, and the pool runs g here if it cannot queue it
+      if (n >= parallel_grain) {
+        pool.fork_join(f, g);
+        return;
+      }
+      f();
+      g();
+    }
+    void discard(pNode n) noexcept {
+      if (!n) return;
+      n->next() = trash.load(std::memory_order_relaxed);
+      while (!trash.compare_exchange_weak(n->next(), n, 
+            std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+    void free_trash(RBTree &tree) noexcept {
+      pNode n = trash.load(std::memory_order_acquire);
+      while (n) {
+        pNode next = n->next();
+        tree.destroy_subtree(n);
+        n = next;
+      }
+    }
+    Pool &pool;
+    std::atomic<pNode> trash {nullptr};
+  };
+  static constexpr size_type parallel_grain = 4096;
+
+  // a's node wins on equal values; b's go to dups, or are discarded if
+  // null; dups needs a serial run
+  template <class Run>
+  Piece unite(Piece a, Piece b, Chain *dups, Run &run) noexcept {
+    if (!a.root) return b;
+    if (!b.root) return a;
+    size_type n = a.root->size() + b.root->size();
+    pNode x = a.root;
+    Piece al, ar, bl, br, l, r;
+    expose(a, al, ar);
+    pNode dup = split_piece(b, x->value(), bl, br);
+    run.fork(n, [&] {
+      l = unite(al, bl, dups, run);
+      // between the two halves to keep dups in order
+      if (dup && dups) {
+        *dups->tail = dup;
+        dups->tail = &dup->next();
+        ++dups->size;
+      } else if (dup) run.discard(dup);
+    }, [&] {r = unite(ar, br, dups, run);});
+    return join_pieces(l, x, r);
+  }
+
+  // a's node is kept, b's nodes are discarded
+  template <class Run>
+  Piece intersect(Piece a, Piece b, Run &run) noexcept {
+    if (!a.root || !b.root) {
+      run.discard(a.root);
+      run.discard(b.root);
+      return Piece();
+    }
+    size_type n = a.root->size() + b.root->size();
+    pNode x = a.root;
+    Piece al, ar, bl, br, l, r;
+    expose(a, al, ar);
+    pNode dup = split_piece(b, x->value(), bl, br);
+    run.fork(n, [&] {l = intersect(al, bl, run);}, 
+             [&] {r = intersect(ar, br, run);});
+    if (dup) {
+      run.discard(dup);
+      return join_pieces(l, x, r);
+    }
+    run.discard(x);
+    return concat_pieces(l, r);
+  }
+
+  // a without the values of b, b's nodes are discarded
+  template <class Run>
+  Piece subtract(Piece a, Piece b, Run &run) noexcept {
+    if (!a.root || !b.root) {
+      run.discard(b.root);
+      return a;
+    }
+    size_type n = a.root->size() + b.root->size();
+    pNode y = b.root;
+    Piece al, ar, bl, br, l, r;
+    expose(b, bl, br);
+    pNode dup = split_piece(a, y->value(), al, ar);
+    run.discard(y);
+    run.discard(dup);
+    run.fork(n, [&] {l = subtract(al, bl, run);}, 
+             [&] {r = subtract(ar, br, run);});
+    return concat_pieces(l, r);
   }
 
 ///////////////////////////////////////////////////////////////////////////////
 // insertion/removal
-  pNode &pointer_to_this(pNode p) {
+  // hang inserted on link (a null child link of parent, or _root),
+  // thread it between its neighbours and rebalance; O(log n) whatever the
+  // rebalancing costs, every ancestor's size and aggregate change
+  pNode link_node(pNode parent, pNode &link, pNode inserted) noexcept {
+    link = inserted;
+    inserted->parent() = parent;
+    update(inserted);
+    update_path(parent);
+    if (inserted->is_root()) {
+      _begin = _root = inserted;
+      _root->next() = _end;
+      _end->prev() = _root;
+    } else {
+      if (parent->left() == inserted) {
+        if (parent->prev()) parent->prev()->next() = inserted;
+        else _begin = inserted;
+        inserted->prev() = parent->prev();
+        parent->prev() = inserted;
+        inserted->next() = parent;
+      } else {
+        parent->next()->prev() = inserted;
+        inserted->next() = parent->next();
+        parent->next() = inserted;
+        inserted->prev() = parent;
+      }
+    }
+    insert_repair_tree(inserted, _root);
+    ++_size;
+    return inserted;
+  }
+
+  // the null link value has to go on if it sorts right before or right
+  // after hint, found through the prev/next threads; nullptr otherwise
+  pNode *hint_link(cNode hint, const_reference value, pNode &parent) {
+    if (!_root) return nullptr;
+    pNode h = const_cast<pNode>(hint);
+    if (h == _end || _comp(value, h->value())) {
+      pNode before = h->prev();
+      if (before && !_comp(before->value(), value)) return nullptr;
+      // h's left subtree is empty or ends at before
+      if (h != _end && !h->left()) {
+        parent = h;
+        return &h->left();
+      }
+      parent = before;
+      return &before->right();
+    }
+    if (_comp(h->value(), value)) {
+      pNode after = h->next();
+      if (after != _end && !_comp(value, after->value())) return nullptr;
+      // h's right subtree is empty or starts at after
+      if (!h->right()) {
+        parent = h;
+        return &h->right();
+      }
+      parent = after;
+      return &after->left();
+    }
+    return nullptr;
+  }
+
+  // detach p from the tree and the prev/next threads, p is not freed;
+  // returns the node after p
+  pNode unlink_node(pNode p) noexcept {
+    //assert(p)
+    // prev/next
+    pNode next = p->next();
+    next->prev() = p->prev();
+    (p->prev()?p->prev()->next():_begin) = next;
+
+    // empty()
+    if (_begin == _end) {
+      destroy_node(_end);
+      _begin = _root = _end = nullptr;
+      _size = 0;
+      return nullptr;
+    }
+
+    if (p->leaf_child_count() == 0) {
+      swap_but_value_prev_next(p, p->prev());
+    }
+    //assert(check_parent());
+    //assert(p->leaf_child_count() >= 0);
+
+    if (p->is_red()) {
+      // assert(p->leaf_child_count() == 2);
+      // assert(!p->is_root());
+      p->pointer_to_this() = nullptr;
+      update_path(p->parent());
+    } else {
+      pNode child = p->left()?p->left():p->right();
+      if (child) {
+        //assert(child->is_red());
+        child->parent() = p->parent();
+        child->set_black();
+        pointer_to_this(p) = child;
+        update_path(child->parent());
+      } else {
+        // p stays in place during the repair but no longer counts
+        p->size() = 0;
+        p->aggregate() = _augment.identity();
+        update_path(p->parent());
+        erase_repair_tree(p);
+        pointer_to_this(p) = nullptr;
+      }
+    }
+
+    --_size;
+    return next;
+  }
+
+  pNode &pointer_to_this(pNode p) noexcept {
+    return pointer_to_this(p, _root);
+  }
+
+  // root is the link holding the top of p's tree
+  static pNode &pointer_to_this(pNode p, pNode &root) noexcept {
     // assert(p);
-    return p->is_root()?_root:p->pointer_to_this();
+    return p->is_root()?root:p->pointer_to_this();
   }
 
-  static void rotate_left(pNode &ptr2this) {
+  // the new top takes over the subtree, so it inherits curr's size and
+  // aggregate; only curr has to be recomputed
+  void rotate_left(pNode &ptr2this) noexcept {
     pNode curr = ptr2this;
     // assert(curr);
-    wNode parent = curr->parent();
-    // assert(parent);
+    pNode parent = curr->parent();
     // assert(curr->right());
     ptr2this = curr->right();
     curr->right()->parent() = parent;
@@ -374,25 +1552,14 @@ private:
     if (ptr2this->left()) ptr2this->left()->parent() = curr;
     ptr2this->left() = curr;
     curr->parent() = ptr2this;
+    ptr2this->size() = curr->size();
+    ptr2this->aggregate() = curr->aggregate();
+    update(curr);
   }
-  void rotate_left(wNode curr) {
-    // assert(curr);
-    pNode p = curr.lock();
-    wNode parent = p->parent();
-    pNode &ptr2this = pointer_to_this(p);
-    // assert(curr->right());
-    ptr2this = p->right();
-    p->right()->parent() = parent;
-    p->right() = ptr2this->left();
-    if (ptr2this->left()) ptr2this->left()->parent() = p;
-    ptr2this->left() = p;
-    p->parent() = ptr2this;
-  }
-  static void rotate_right(pNode &ptr2this) {
+  void rotate_right(pNode &ptr2this) noexcept {
     pNode curr = ptr2this;
     // assert(curr);
-    wNode parent = curr->parent();
-    // assert(parent);
+    pNode parent = curr->parent();
     // assert(curr->left());
     ptr2this = curr->left();
     curr->left()->parent() = parent;
@@ -400,136 +1567,161 @@ private:
     if (ptr2this->right()) ptr2this->right()->parent() = curr;
     ptr2this->right() = curr;
     curr->parent() = ptr2this;
+    ptr2this->size() = curr->size();
+    ptr2this->aggregate() = curr->aggregate();
+    update(curr);
   }
-  void rotate_right(wNode curr) {
-    // assert(curr);
-    pNode p = curr.lock();
-    wNode parent = p->parent();
-    pNode &ptr2this = pointer_to_this(p);
-    // assert(curr->left());
-    ptr2this = p->left();
-    p->left()->parent() = parent;
-    p->left() = ptr2this->right();
-    if (ptr2this->right()) ptr2this->right()->parent() = p;
-    ptr2this->right() = p;
-    p->parent() = ptr2this;
+
+  static size_type size_of(cNode n) noexcept {
+    return n ? n->size() : 0;
+  }
+
+  aggregate_type aggregate_of(cNode n) const {
+    return n ? n->aggregate() : _augment.identity();
+  }
+
+  // recompute size and aggregate of n from its children
+  void update(pNode n) {
+    n->size() = size_of(n->left()) + size_of(n->right()) + 1;
+    n->aggregate() = _augment.combine(_augment.combine(
+          aggregate_of(n->left()), _augment.lift(n->value())), 
+        aggregate_of(n->right()));
+  }
+
+  // n and all its ancestors
+  void update_path(pNode n) {
+    for (; n; n = n->parent()) update(n);
+  }
+
+  template <typename Y>
+  static bool is_red(Y n) noexcept {
+    return n && n->is_red();
+  }
+  template <typename Y>
+  static bool is_black(Y n) noexcept {
+    return !is_red(n);
   }
 
-  // insertion
-  void insert_repair_tree(wNode curr) noexcept {
+  // insertion; works on any tree or piece whose top is held by root,
+  // returns true if root turned black, which adds one to the black height
+  bool insert_repair_tree(pNode curr, pNode &root) noexcept {
     // assert(curr);
-    if (curr->is_root()) curr->set_black();
-    else if (curr->parent()->is_red()) {
-      auto uncle = curr->uncle();
-      auto grandparent = curr->grandparent();
-      if (uncle && uncle->is_red()) {
+    while (!curr->is_root() && curr->parent()->is_red()) {
+      pNode uncle = curr->uncle();
+      pNode grandparent = curr->grandparent();
+      if (is_red(uncle)) {
         curr->parent()->set_black();
         uncle->set_black();
         grandparent->set_red();
-        insert_repair_tree(grandparent);
-      } else {
-        if (curr == curr->parent()->right() && 
-            curr->parent() == grandparent->left()) {
-          rotate_left(grandparent->left());
-          curr = curr->left();
-        } else if (curr == curr->parent()->left() && 
-            curr->parent() == grandparent->right()) {
-          rotate_right(grandparent->right());
-          curr = curr->right();
-        }
-        wNode parent = curr->parent();
-        wNode grandparent = parent->parent();
-        if (grandparent->left() == parent)
-          rotate_right(grandparent);
-        else
-          rotate_left(grandparent);
-        parent->set_black();
-        grandparent->set_red();
+        curr = grandparent;
+        continue;
+      }
+      if (curr == curr->parent()->right() && 
+          curr->parent() == grandparent->left()) {
+        rotate_left(grandparent->left());
+        curr = curr->left();
+      } else if (curr == curr->parent()->left() && 
+          curr->parent() == grandparent->right()) {
+        rotate_right(grandparent->right());
+        curr = curr->right();
       }
+      pNode parent = curr->parent();
+      if (grandparent->left() == parent)
+        rotate_right(pointer_to_this(grandparent, root));
+      else
+        rotate_left(pointer_to_this(grandparent, root));
+      parent->set_black();
+      grandparent->set_red();
+      break;
     }
+    bool grown = root->is_red();
+    root->set_black();
+    return grown;
   }
   
   // assert(p)
   // assert(p->is_black())
   // path starting from non-empty pointer p is missing one black node,
   // fix it
-  void erase_repair_tree(wNode curr) noexcept {
-    erase_repair_tree(curr.lock());
-  }
-  // deletion
   void erase_repair_tree(pNode p) noexcept {
     using std::swap;
-    if (p->is_root()) return;
-
-    // assert(p->parent() && p->is_black());
-    if (p->parent()->left() == p) {
-      pNode sib = p->parent()->right();
-      if(is_red(sib)) {
-        //assert(sib && p->parent()->is_black());
-        rotate_left(p->parent());
-        swap(p->parent()->color(), sib->color());
-      }
-      sib = p->parent()->right();
-      //assert(sib->is_black());
-      if (erase_repair_tree_34(p, sib)) return;
-      if (is_black(sib->right())) {
-        // assert(is_red(sib->left()));
-        rotate_right(p->parent()->right());
-        swap(sib->parent()->color(), sib->color());
-      }
-      sib = p->parent()->right();
-      // assert(is_red(sib->right()));
-      sib->right()->set_black();
-      swap(sib->parent()->color(), sib->color());
-      rotate_left(p->parent());
-    } else {
-      pNode sib = p->parent()->left();
-      if(is_red(sib)) {
-        //assert(sib && p->parent()->is_black());
-        rotate_right(p->parent());
-        swap(p->parent()->color(), sib->color());
-      }
-      sib = p->parent()->left();
-      //assert(sib->is_black());
-      if (erase_repair_tree_34(p, sib)) return;
-      if (is_black(sib->left())) {
+    while (!p->is_root()) {
+      // assert(p->parent() && p->is_black());
+      if (p->parent()->left() == p) {
+        pNode sib = p->parent()->right();
+        if(is_red(sib)) {
+          //assert(sib && p->parent()->is_black());
+          rotate_left(pointer_to_this(p->parent()));
+          swap(p->parent()->color(), sib->color());
+        }
+        sib = p->parent()->right();
+        //assert(sib->is_black());
+        if (erase_repair_tree_34(p, sib)) continue;
+        if (is_black(sib->right())) {
+          // assert(is_red(sib->left()));
+          rotate_right(p->parent()->right());
+          swap(sib->parent()->color(), sib->color());
+        }
+        sib = p->parent()->right();
         // assert(is_red(sib->right()));
-        rotate_left(p->parent()->left());
+        sib->right()->set_black();
         swap(sib->parent()->color(), sib->color());
+        rotate_left(pointer_to_this(p->parent()));
+      } else {
+        pNode sib = p->parent()->left();
+        if(is_red(sib)) {
+          //assert(sib && p->parent()->is_black());
+          rotate_right(pointer_to_this(p->parent()));
+          swap(p->parent()->color(), sib->color());
+        }
+        sib = p->parent()->left();
+        //assert(sib->is_black());
+        if (erase_repair_tree_34(p, sib)) continue;
+        if (is_black(sib->left())) {
+          // assert(is_red(sib->right()));
+          rotate_left(p->parent()->left());
+          swap(sib->parent()->color(), sib->color());
+        }
+        sib = p->parent()->left();
+        // assert(is_red(sib->left()));
+        sib->left()->set_black();
+        swap(sib->parent()->color(), sib->color());
+        rotate_right(pointer_to_this(p->parent()));
       }
-      sib = p->parent()->left();
-      // assert(is_red(sib->left()));
-      sib->left()->set_black();
-      swap(sib->parent()->color(), sib->color());
-      rotate_right(p->parent());
+      return;
     }
   }
   // CASE 3-4
-  bool erase_repair_tree_34(pNode p, pNode sib) noexcept {
+  // returns true if sib could absorb the missing black; p then moves up
+  // to the parent if that still misses one, or to the root if done
+  bool erase_repair_tree_34(pNode &p, pNode sib) noexcept {
     // assert(p->parent() && p->is_black());
     // assert(sib->is_black());
     if (sib && is_black(sib->left()) && is_black(sib->right())) {
       sib->set_red();
       if (p->parent()->is_black())
-        erase_repair_tree(p->parent());
-      else
+        p = p->parent();
+      else {
         p->parent()->set_black();
+        p = _root;
+      }
       return true;
     }
     return false;
   }
 
   // swap everything except value and prev/next
-  void swap_but_value_prev_next(pNode lhs, pNode rhs) {
+  void swap_but_value_prev_next(pNode lhs, pNode rhs) noexcept {
     //if (lhs == rhs) return;
 
     using std::swap;
     
-    // swap color
+    // swap color and subtree size
     swap(lhs->color(), rhs->color());
+    swap(lhs->size(), rhs->size());
 
     // swap child
-    wNode lparent = lhs, rparent = rhs;
+    pNode lparent = lhs, rparent = rhs;
     swap(
     lhs->left()?lhs->left()->parent():lparent,
     rhs->left()?rhs->left()->parent():rparent);
@@ -545,30 +1737,146 @@ private:
     swap(lhs->parent(), rhs->parent());
   }
 
+///////////////////////////////////////////////////////////////////////////////
+// batch
+  // the values with their positions, stably sorted
+  template <class Range>
+  std::vector<std::pair<const value_type*, size_type>>
+  sort_batch(const Range &values) const {
+    std::vector<std::pair<const value_type*, size_type>> order;
+    size_type i = 0;
+    for (const auto &x : values) order.emplace_back(&x, i++);
+    std::stable_sort(order.begin(), order.end(),
+        [this](const std::pair<const value_type*, size_type> &lhs,
+               const std::pair<const value_type*, size_type> &rhs) {
+          return _comp(*lhs.first, *rhs.first);
+        });
+    return order;
+  }
+
+  // the link of the lowest subtree around finger whose range holds value;
+  // every node before finger must be less than value. parent is set to
+  // the parent of that subtree.
+  pNode &finger_link(pNode finger, const_reference value, pNode &parent) {
+    if (!_root) finger = nullptr;
+    else if (finger == _end) finger = _end->prev();
+    if (!finger) {
+      parent = nullptr;
+      return _root;
+    }
+    pNode n = finger;
+    while (!n->is_root()) {
+      pNode p = n->parent();
+      if (p->left() == n && _comp(value, p->value())) break;
+      n = p;
+    }
+    parent = n->parent();
+    return pointer_to_this(n);
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 // lookup
+  static const_iterator iterator_to(cNode n) noexcept {return n;}
+
   std::pair<pNode&, bool> find(pNode &curr, const_reference value) {
-    pNode parent;
+    pNode parent = nullptr;
     return find(curr, value, parent);
   }
 
-  //std::pair<cNode, bool> 
-  //  find(cNode curr, const_reference value) const {
-  //  return find(const_cast<pNode&>(curr), value);
-  //}
+  // first node whose value is not less than value, or _end
+  cNode lower_bound_node(const_reference value) const {
+    cNode curr = _root;
+    cNode result = _end;
+    while (curr) {
+      if (_comp(curr->value(), value)) curr = curr->right();
+      else {
+        result = curr;
+        curr = curr->left();
+      }
+    }
+    return result;
+  }
 
+  // f(value, lower_bound_node(value)) for each value of [first, last) in
+  // order, the nodes of lockstep values at a time found together
+  template <class ForwardIt, class F>
+  void lower_bound_each(ForwardIt first, ForwardIt last, F f) const {
+    cNode lower[lockstep];
+    while (first != last) {
+      ForwardIt group = first;
+      size_type n = 0;
+      for (; n != lockstep && group != last; ++n) ++group;
+      lower_bound_nodes(first, n, lower);
+      for (size_type i = 0; i != n; ++i, ++first) f(*first, lower[i]);
+    }
+  }
+
+  bool matches(cNode lower, const_reference value) const {
+    return lower && lower != _end && !_comp(value, lower->value());
+  }
+
+  // lower_bound_node of n <= lockstep values at once, descending one level
+  // for each in turn; nullptr if the tree is empty
+  template <class ForwardIt>
+  void lower_bound_nodes(ForwardIt first, size_type n, cNode *result) const {
+    cNode curr[lockstep];
+    const value_type *values[lockstep];
+    for (size_type i = 0; i != n; ++i, ++first) {
+      curr[i] = _root;
+      result[i] = _end;
+      values[i] = &*first;
+    }
+    for (bool active = _root != nullptr; active; ) {
+      active = false;
+      for (size_type i = 0; i != n; ++i) {
+        if (!curr[i]) continue;
+        active = true;
+        if (_comp(curr[i]->value(), *values[i])) curr[i] = curr[i]->right();
+        else {
+          result[i] = curr[i];
+          curr[i] = curr[i]->left();
+        }
+        prefetch(curr[i]);
+      }
+    }
+  }
+
+  // descents in lockstep; enough to keep a few misses in flight each step
+  static constexpr size_type lockstep = 16;
+
+  static void prefetch(cNode n) noexcept {
+#if defined(__GNUC__)
+    __builtin_prefetch(n);
+#else
+    (void)n;
+#endif
+  }
+
+  // first node whose value is greater than value, or _end
+  cNode upper_bound_node(const_reference value) const {
+    cNode curr = _root;
+    cNode result = _end;
+    while (curr) {
+      if (_comp(value, curr->value())) {
+        result = curr;
+        curr = curr->left();
+      } else curr = curr->right();
+    }
+    return result;
+  }
+
+  // iterative descent; parent is left untouched on a hit at curr
   std::pair<pNode&, bool> find(pNode &curr, const_reference value, 
       pNode &parent) {
-    if (!curr) return {curr, false};
-    if (_comp(curr->value(), value)) {
-      parent = curr; 
-      return find(curr->right(), value, parent);
-    }
-    if (_comp(value, curr->value())) {
-      parent = curr;
-      return find(curr->left(), value, parent);
+    pNode *link = &curr;
+    while (*link) {
+      pNode p = *link;
+      if (_comp(p->value(), value)) link = &p->right();
+      else if (_comp(value, p->value())) link = &p->left();
+      else return {*link, true};
+      parent = p;
     }
-    return {curr, true};
+    return {*link, false};
   }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -591,6 +1899,30 @@ private:
            check_reds_children(n->right());
   }
   
+  static std::pair<size_type, bool> check_size(cNode n) {
+    if (!n) return {0, true};
+    auto ls = check_size(n->left());
+    auto rs = check_size(n->right());
+    size_type size = ls.first + rs.first + 1;
+    return {size, ls.second && rs.second && n->size() == size};
+  }
+
+  // recomputes every aggregate; skipped when aggregate_type has no ==,
+  // and only exact when combine is (rotations reassociate it)
+  bool check_aggregate(cNode n) const {
+    if (!n) return true;
+    return check_aggregate(n->left()) && check_aggregate(n->right())
+      && same_aggregate(n->aggregate(), _augment.combine(_augment.combine(
+              aggregate_of(n->left()), _augment.lift(n->value())),
+            aggregate_of(n->right())));
+  }
+
+  template <typename A>
+  static auto same_aggregate(const A &lhs, const A &rhs) 
+    -> decltype(bool(lhs == rhs)) {return lhs == rhs;}
+  template <typename... Args>
+  static bool same_aggregate(const Args &...) {return true;}
+
   static std::pair<size_type, bool> check_black_height(cNode n) {
     if (!n) return {1, true};
     auto lh = check_black_height(n->left());
@@ -603,8 +1935,9 @@ private:
 
 ///////////////////////////////////////////////////////////////////////////////
 // non-member functions
-template <typename T, typename Compare>
-void swap(RBTree<T, Compare> &lhs, RBTree<T, Compare> &rhs) noexcept
+template <typename T, typename Compare, typename Allocator, typename Augment>
+void swap(RBTree<T, Compare, Allocator, Augment> &lhs, 
+          RBTree<T, Compare, Allocator, Augment> &rhs) noexcept
 {
   lhs.swap(rhs);
 }
@@ -612,11 +1945,13 @@ void swap(RBTree<T, Compare> &lhs, RBTree<T, Compare> &rhs) noexcept
 //#include <iostream>
 #include <queue>
 #include <string>
-template <typename T, typename Compare>
-std::ostream& operator<<(std::ostream &os, const RBTree<T, Compare> &rbt)
+template <typename T, typename Compare, typename Allocator, typename Augment>
+std::ostream& operator<<(std::ostream &os, 
+                         const RBTree<T, Compare, Allocator, Augment> &rbt)
 {
-  using size_type = typename RBTree<T, Compare>::size_type;
-  using cNode = typename RBTree<T, Compare>::cNode;
+  using Tree = RBTree<T, Compare, Allocator, Augment>;
+  using size_type = typename Tree::size_type;
+  using cNode = typename Tree::cNode;
 
   static constexpr size_type SPACE = 4;
   std::queue<std::pair<size_type, cNode>> nq;
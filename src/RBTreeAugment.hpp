@@ -0,0 +1,87 @@
+#ifndef __RBTREE_AUGMENT_HPP_INCLUDED
+#define __RBTREE_AUGMENT_HPP_INCLUDED
+
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+// Augmentation policies for RBTree.
+//
+// A policy folds the values of every subtree into an aggregate_type kept
+// in the subtree root; the fold must be a monoid:
+//   aggregate_type identity() const;
+//   aggregate_type lift(const T &value) const;
+//   aggregate_type combine(const aggregate_type &lhs,
+//                          const aggregate_type &rhs) const;
+// combine has to be associative, it is always applied in key order
+// (left subtree, node, right subtree). lift and combine run inside the
+// rebalancing and must not throw.
+
+// keeps nothing, the node pays no space for it
+struct RBTreeNoAugment {
+  struct aggregate_type {};
+
+  aggregate_type identity() const noexcept {return {};}
+  template <typename T>
+  aggregate_type lift(const T &) const noexcept {return {};}
+  aggregate_type combine(aggregate_type, aggregate_type) const noexcept
+  {return {};}
+};
+
+template <typename T>
+struct RBTreeSumAugment {
+  using aggregate_type = T;
+
+  aggregate_type identity() const {return aggregate_type();}
+  aggregate_type lift(const T &value) const {return value;}
+  aggregate_type combine(const aggregate_type &lhs,
+                         const aggregate_type &rhs) const
+  {return lhs + rhs;}
+};
+
+template <typename T>
+struct RBTreeMinAugment {
+  static_assert(std::numeric_limits<T>::is_specialized,
+      "RBTreeMinAugment needs std::numeric_limits<T>");
+  using aggregate_type = T;
+
+  aggregate_type identity() const {return std::numeric_limits<T>::max();}
+  aggregate_type lift(const T &value) const {return value;}
+  aggregate_type combine(const aggregate_type &lhs,
+                         const aggregate_type &rhs) const
+  {return rhs < lhs ? rhs : lhs;}
+};
+
+template <typename T>
+struct RBTreeMaxAugment {
+  static_assert(std::numeric_limits<T>::is_specialized,
+      "RBTreeMaxAugment needs std::numeric_limits<T>");
+  using aggregate_type = T;
+
+  aggregate_type identity() const
+  {return std::numeric_limits<T>::lowest();}
+  aggregate_type lift(const T &value) const {return value;}
+  aggregate_type combine(const aggregate_type &lhs,
+                         const aggregate_type &rhs) const
+  {return lhs < rhs ? rhs : lhs;}
+};
+
+// storage of the aggregate inside a node; empty aggregates take no space
+template <typename A, bool = std::is_empty<A>::value>
+class RBTreeAggregateHolder {
+public:
+  A &aggregate() noexcept {return _aggregate;}
+  const A &aggregate() const noexcept {return _aggregate;}
+
+private:
+  A _aggregate = A();
+};
+
+template <typename A>
+class RBTreeAggregateHolder<A, true> : private A {
+public:
+  A &aggregate() noexcept {return *this;}
+  const A &aggregate() const noexcept {return *this;}
+};
+
+#endif // __RBTREE_AUGMENT_HPP_INCLUDED
@@ -0,0 +1,212 @@
+#ifndef __RBTREE_BUFFERED_HPP_INCLUDED
+#define __RBTREE_BUFFERED_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+template <typename, typename, typename, typename, std::size_t>
+class RBTreeBuffered;
+#include <RBTree.hpp>
+
+// RBTree whose inserts wait in a small unsorted buffer
+//
+// defer() appends to a buffer of Capacity values; insert() looks the
+// value up first, to say whether it is new. Once the buffer is full it is
+// sorted and merged into the tree with the sorted_unique insert, which
+// searches for a group of positions at once so their cache misses
+// overlap. Lookups scan the buffer, then search the tree; the scan has
+// no early exit, so it vectorizes for arithmetic T. Anything that
+// depends on order (iteration, bounds, size) merges first and sees
+// exactly the tree the same inserts would have built. Of equal values,
+// the one inserted first stays, as with RBTree::insert.
+//
+// Const members merge too, through mutable members: unlike RBTree, even
+// const access from several threads at once needs external locking.
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>,
+          typename Augment = RBTreeNoAugment, std::size_t Capacity = 128>
+class RBTreeBuffered {
+  static_assert(Capacity > 0, "Capacity must be positive");
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using tree_type = RBTree<T, Compare, Allocator, Augment>;
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using iterator = typename tree_type::iterator;
+  using const_iterator = typename tree_type::const_iterator;
+  using reverse_iterator = typename tree_type::reverse_iterator;
+  using const_reverse_iterator = typename tree_type::const_reverse_iterator;
+  using size_type = typename tree_type::size_type;
+  using difference_type = typename tree_type::difference_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  explicit RBTreeBuffered(const Compare& comp = Compare(),
+                          const Allocator& alloc = Allocator())
+    : RBTreeBuffered(tree_type(comp, alloc)) {}
+  template <class InputIt>
+  RBTreeBuffered(InputIt first, InputIt last,
+                 const Compare& comp = Compare(),
+                 const Allocator& alloc = Allocator())
+    : RBTreeBuffered(tree_type(first, last, comp, alloc)) {}
+  explicit RBTreeBuffered(tree_type &&tree)
+    : _tree(std::move(tree)), _buffer(_tree.get_allocator()) {
+    _buffer.reserve(Capacity);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// iterators
+  iterator begin() const {return tree().begin();}
+  iterator end() const {return tree().end();}
+  const_iterator cbegin() const {return tree().cbegin();}
+  const_iterator cend() const {return tree().cend();}
+  reverse_iterator rbegin() const {return tree().rbegin();}
+  reverse_iterator rend() const {return tree().rend();}
+  const_reverse_iterator crbegin() const {return tree().crbegin();}
+  const_reverse_iterator crend() const {return tree().crend();}
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const {return _buffer.empty() && _tree.empty();}
+  size_type size() const {return tree().size();}
+  size_type buffered() const noexcept {return _buffer.size();}
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void clear() noexcept {
+    _buffer.clear();
+    _tree.clear();
+  }
+
+  // buffer value without looking for it: the fast path, whose searches
+  // the merge overlaps
+  void defer(const_reference value) {
+    _buffer.push_back(value);
+    if (_buffer.size() == Capacity) merge();
+  }
+  void defer(value_type &&value) {
+    _buffer.push_back(std::move(value));
+    if (_buffer.size() == Capacity) merge();
+  }
+
+  // true if value was not in the set yet, like RBTree::insert's second;
+  // there is no iterator to return, the node is only made at the merge.
+  // Finding out costs a search of the tree, most of what RBTree::insert
+  // costs, so only the node and the rebalancing are deferred
+  bool insert(const_reference value) {
+    if (contains(value)) return false;
+    defer(value);
+    return true;
+  }
+  bool insert(value_type &&value) {
+    if (contains(value)) return false;
+    defer(std::move(value));
+    return true;
+  }
+  // the value is built first, to look it up
+  template <typename... Args>
+  bool emplace(Args && ... args) {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  size_type erase(const_reference value) {
+    auto kept = std::remove_if(_buffer.begin(), _buffer.end(),
+        [this, &value](const_reference x) {return equal(x, value);});
+    bool buffered = kept != _buffer.end();
+    _buffer.erase(kept, _buffer.end());
+    return _tree.erase(value) || buffered;
+  }
+  iterator erase(const_iterator pos) {
+    merge();
+    return _tree.erase(pos);
+  }
+  iterator erase(const_iterator first, const_iterator last) {
+    merge();
+    return _tree.erase(first, last);
+  }
+
+  // sort the buffer into the tree now; if an allocation throws, the
+  // buffer is kept, and merging it again later is harmless. Const, and
+  // still a write, see above
+  void merge() const {
+    if (_buffer.empty()) return;
+    Compare comp = _tree.value_comp();
+    std::stable_sort(_buffer.begin(), _buffer.end(), comp);
+    _buffer.erase(std::unique(_buffer.begin(), _buffer.end(),
+          [&comp](const_reference lhs, const_reference rhs) {
+            return !comp(lhs, rhs);
+          }), _buffer.end());
+    _tree.insert(sorted_unique, _buffer.begin(), _buffer.end());
+    _buffer.clear();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  // merges if value is buffered; an empty tree has no end() yet that
+  // would last past the merge
+  iterator find(const_reference value) const {
+    if (_tree.empty() || in_buffer(value)) merge();
+    return _tree.find(value);
+  }
+
+  size_type count(const_reference value) const {return contains(value);}
+  bool contains(const_reference value) const {
+    return in_buffer(value) || _tree.contains(value);
+  }
+
+  iterator lower_bound(const_reference value) const {
+    return tree().lower_bound(value);
+  }
+  iterator upper_bound(const_reference value) const {
+    return tree().upper_bound(value);
+  }
+  std::pair<iterator, iterator> equal_range(const_reference value) const {
+    return tree().equal_range(value);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  value_compare value_comp() const {return _tree.value_comp();}
+  allocator_type get_allocator() const {return _tree.get_allocator();}
+
+  // the tree with the buffer merged in, a write like merge()
+  const tree_type &tree() const {
+    merge();
+    return _tree;
+  }
+
+private:
+  bool equal(const_reference lhs, const_reference rhs) const {
+    Compare comp = _tree.value_comp();
+    return !comp(lhs, rhs) && !comp(rhs, lhs);
+  }
+
+  bool in_buffer(const_reference value) const {
+    return scan(value, std::is_arithmetic<value_type>());
+  }
+  // every slot, no branch per slot
+  bool scan(const_reference value, std::true_type) const {
+    Compare comp = _tree.value_comp();
+    bool found = false;
+    for (const auto &x : _buffer) found |= !comp(x, value) & !comp(value, x);
+    return found;
+  }
+  bool scan(const_reference value, std::false_type) const {
+    return std::any_of(_buffer.begin(), _buffer.end(),
+        [this, &value](const_reference x) {return equal(x, value);});
+  }
+
+  mutable tree_type _tree;
+  mutable std::vector<value_type, Allocator> _buffer;
+};
+
+#endif // __RBTREE_BUFFERED_HPP_INCLUDED
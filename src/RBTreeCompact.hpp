@@ -0,0 +1,458 @@
+#ifndef __RBTREE_COMPACT_HPP_INCLUDED
+#define __RBTREE_COMPACT_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+template <typename, typename, typename>
+class RBTreeCompact;
+#include <RBTreeCompactIterator.hpp>
+#include <RBTreeCompactNode.hpp>
+
+// opt-in compact variant of RBTree
+//
+// nodes live in one std::vector and link to each other by 32-bit index,
+// the color is packed into the parent index, and there are no prev/next
+// threads, so an RBTreeCompact<int> node takes 16 bytes. Slot 0 is a
+// header (its left link is the root, it is also end()), made by the first
+// insert so that an empty or moved-from tree owns no memory; erased slots
+// are reset to T() and kept on a free list for reuse, so iterators stay
+// valid until their own element is erased. At most 2^31 - 2 elements.
+template <typename T, typename Compare = std::less<T>, typename Enable = void>
+class RBTreeCompact;
+
+template <typename T, typename Compare>
+class RBTreeCompact<T, Compare,
+      typename std::enable_if<std::is_assignable<T&, T>::value
+      && !std::is_reference<T>::value>::type> {
+
+  using Node = RBTreeCompactNode<T>;
+  using index_type = typename Node::index_type;
+  static constexpr index_type nil = Node::nil;
+  static constexpr index_type header = 0;
+
+public:
+
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using value_compare = Compare;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using iterator = RBTreeCompactIterator<const T>;
+  using const_iterator = RBTreeCompactIterator<const T>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using size_type = std::size_t;
+  using difference_type = typename iterator::difference_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  explicit RBTreeCompact(const Compare& comp = Compare())
+    : _comp(comp) {}
+  template <class InputIt>
+  RBTreeCompact(InputIt first, InputIt last,
+                const Compare& comp = Compare())
+    : RBTreeCompact(comp) {
+    insert(first, last);
+  }
+  RBTreeCompact(const RBTreeCompact &other) = default;
+  RBTreeCompact(RBTreeCompact &&other) noexcept
+    : _nodes(std::move(other._nodes)), _free(other._free),
+      _size(other._size), _comp(other._comp) {
+    other._free = nil;
+    other._size = 0;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// operator=
+  RBTreeCompact &operator=(const RBTreeCompact &other) {
+    RBTreeCompact cpy(other);
+    this->swap(cpy);
+    return *this;
+  }
+  RBTreeCompact &operator=(RBTreeCompact &&other) noexcept {
+    this->swap(other); return *this;}
+
+///////////////////////////////////////////////////////////////////////////////
+// iterators
+  iterator begin() noexcept {return cbegin();}
+  const_iterator begin() const noexcept {return cbegin();}
+  const_iterator cbegin() const noexcept {
+    index_type curr = root();
+    if (curr == nil) return cend();
+    while (node(curr).left() != nil) curr = node(curr).left();
+    return make_iterator(curr);
+  }
+  iterator end() noexcept {return cend();}
+  const_iterator end() const noexcept {return cend();}
+  const_iterator cend() const noexcept {return make_iterator(header);}
+  reverse_iterator rbegin() noexcept
+  {return std::make_reverse_iterator(end());}
+  const_reverse_iterator crbegin() const noexcept
+  {return std::make_reverse_iterator(cend());}
+  reverse_iterator rend() noexcept
+  {return std::make_reverse_iterator(begin());}
+  const_reverse_iterator crend() const noexcept
+  {return std::make_reverse_iterator(cbegin());}
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return _size == 0;}
+  size_type size() const noexcept {return _size;}
+  size_type max_size() const noexcept {return nil - 1;}
+
+  // reserve node slots up front (the header takes one)
+  void reserve(size_type n) {_nodes.reserve(n + 1);}
+  size_type capacity() const noexcept {
+    return _nodes.capacity() ? _nodes.capacity() - 1 : 0;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void clear() noexcept {
+    _nodes.clear();
+    _free = nil;
+    _size = 0;
+  }
+
+  std::pair<iterator, bool> insert(const_reference value) {
+    if (_nodes.empty()) _nodes.emplace_back();
+    index_type parent = nil;
+    index_type curr = root();
+    bool left = true;
+    while (curr != nil) {
+      parent = curr;
+      if (_comp(value, node(curr).value())) {
+        curr = node(curr).left();
+        left = true;
+      } else if (_comp(node(curr).value(), value)) {
+        curr = node(curr).right();
+        left = false;
+      } else return {make_iterator(curr), false};
+    }
+    index_type inserted = create_node(value);
+    node(inserted).set_parent(parent);
+    if (parent == nil) root() = inserted;
+    else if (left) node(parent).left() = inserted;
+    else node(parent).right() = inserted;
+    insert_repair_tree(inserted);
+    ++_size;
+    return {make_iterator(inserted), true};
+  }
+
+  template <class InputIt>
+  void insert(InputIt first, InputIt last) {
+    while (first != last) insert(*first++);
+  }
+
+  iterator erase(const_iterator pos) {
+    const_iterator next = std::next(pos);
+    erase_node(pos._idx);
+    return next;
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    while (first != last) erase(first++);
+    return last;
+  }
+
+  size_type erase(const_reference value) {
+    auto it = find(value);
+    if (it == end()) return 0;
+    erase(it);
+    return 1;
+  }
+
+  void swap(RBTreeCompact &other) noexcept {
+    using std::swap;
+    swap(_nodes, other._nodes);
+    swap(_free, other._free);
+    swap(_size, other._size);
+    swap(_comp, other._comp);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  const_iterator find(const_reference value) const {
+    index_type curr = root();
+    while (curr != nil) {
+      if (_comp(value, node(curr).value())) curr = node(curr).left();
+      else if (_comp(node(curr).value(), value)) curr = node(curr).right();
+      else return make_iterator(curr);
+    }
+    return cend();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  value_compare value_comp() const {return _comp;}
+
+#ifndef NDEBUG
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  bool check_parent() const {
+    return root() == nil ||
+      (node(root()).is_root() && check_parent(root()));
+  }
+
+  bool is_valid_rb_tree() const {
+    return is_black(root()) && check_reds_children(root())
+      && check_black_height(root()).second;
+  }
+#endif  //NDEBUG
+
+private:
+  std::vector<Node> _nodes;
+  index_type _free = nil; // free slots, chained through left()
+  size_type _size = 0;
+  Compare _comp;
+
+///////////////////////////////////////////////////////////////////////////////
+// node access
+  Node &node(index_type i) noexcept {return _nodes[i];}
+  const Node &node(index_type i) const noexcept {return _nodes[i];}
+  index_type &root() noexcept {return node(header).left();}
+  index_type root() const noexcept {
+    return _nodes.empty() ? nil : node(header).left();
+  }
+
+  const_iterator make_iterator(index_type i) const noexcept {
+    return const_iterator(&_nodes, i);
+  }
+
+  bool is_red(index_type i) const noexcept {
+    return i != nil && node(i).is_red();
+  }
+  bool is_black(index_type i) const noexcept {return !is_red(i);}
+
+  index_type create_node(const_reference value) {
+    index_type i;
+    if (_free != nil) {
+      i = _free;
+      node(i).value() = value;
+      _free = node(i).left();
+      node(i).left() = nil;
+    } else {
+      if (_nodes.size() >= nil)
+        throw std::length_error("RBTreeCompact: too many nodes");
+      i = static_cast<index_type>(_nodes.size());
+      _nodes.emplace_back(value);
+    }
+    node(i).right() = nil;
+    node(i).set_red();
+    return i;
+  }
+
+  // the slot is free before its value is reset, so a throwing T() still
+  // leaves the tree whole
+  void destroy_node(index_type i) {
+    node(i).left() = _free;
+    _free = i;
+    node(i).value() = value_type();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// insertion/removal
+  // make parent (nil for the root) point to to instead of from
+  void replace_child(index_type parent, index_type from,
+                     index_type to) noexcept {
+    if (parent == nil) root() = to;
+    else if (node(parent).left() == from) node(parent).left() = to;
+    else node(parent).right() = to;
+  }
+
+  void rotate_left(index_type curr) noexcept {
+    index_type r = node(curr).right();
+    node(curr).right() = node(r).left();
+    if (node(r).left() != nil) node(node(r).left()).set_parent(curr);
+    index_type parent = node(curr).parent();
+    node(r).set_parent(parent);
+    replace_child(parent, curr, r);
+    node(r).left() = curr;
+    node(curr).set_parent(r);
+  }
+
+  void rotate_right(index_type curr) noexcept {
+    index_type l = node(curr).left();
+    node(curr).left() = node(l).right();
+    if (node(l).right() != nil) node(node(l).right()).set_parent(curr);
+    index_type parent = node(curr).parent();
+    node(l).set_parent(parent);
+    replace_child(parent, curr, l);
+    node(l).right() = curr;
+    node(curr).set_parent(l);
+  }
+
+  void insert_repair_tree(index_type curr) noexcept {
+    while (!node(curr).is_root() && node(node(curr).parent()).is_red()) {
+      index_type parent = node(curr).parent();
+      index_type grandparent = node(parent).parent();
+      bool parent_is_left = node(grandparent).left() == parent;
+      index_type uncle = parent_is_left ?
+        node(grandparent).right() : node(grandparent).left();
+      if (is_red(uncle)) {
+        node(parent).set_black();
+        node(uncle).set_black();
+        node(grandparent).set_red();
+        curr = grandparent;
+        continue;
+      }
+      if (parent_is_left) {
+        if (node(parent).right() == curr) {
+          rotate_left(parent);
+          std::swap(curr, parent);
+        }
+        rotate_right(grandparent);
+      } else {
+        if (node(parent).left() == curr) {
+          rotate_right(parent);
+          std::swap(curr, parent);
+        }
+        rotate_left(grandparent);
+      }
+      node(parent).set_black();
+      node(grandparent).set_red();
+      break;
+    }
+    node(root()).set_black();
+  }
+
+  void erase_node(index_type z) {
+    index_type y = z;
+    index_type x;
+    index_type x_parent;
+    if (node(z).left() == nil) x = node(z).right();
+    else if (node(z).right() == nil) x = node(z).left();
+    else {
+      y = node(z).right();
+      while (node(y).left() != nil) y = node(y).left();
+      x = node(y).right();
+    }
+
+    if (y != z) {
+      // move the successor y into z's place, z takes y's color
+      node(node(z).left()).set_parent(y);
+      node(y).left() = node(z).left();
+      if (y != node(z).right()) {
+        x_parent = node(y).parent();
+        if (x != nil) node(x).set_parent(x_parent);
+        node(x_parent).left() = x;
+        node(y).right() = node(z).right();
+        node(node(z).right()).set_parent(y);
+      } else x_parent = y;
+      replace_child(node(z).parent(), z, y);
+      node(y).set_parent(node(z).parent());
+      node(y).swap_color(node(z));
+    } else {
+      x_parent = node(z).parent();
+      if (x != nil) node(x).set_parent(x_parent);
+      replace_child(x_parent, z, x);
+    }
+
+    if (node(z).is_black()) erase_repair_tree(x, x_parent);
+    --_size;
+    destroy_node(z);
+  }
+
+  // path through x (possibly nil, child of x_parent) misses one black node
+  void erase_repair_tree(index_type x, index_type x_parent) noexcept {
+    while (x != root() && is_black(x)) {
+      if (x == node(x_parent).left()) {
+        index_type sib = node(x_parent).right();
+        if (is_red(sib)) {
+          node(sib).set_black();
+          node(x_parent).set_red();
+          rotate_left(x_parent);
+          sib = node(x_parent).right();
+        }
+        if (is_black(node(sib).left()) && is_black(node(sib).right())) {
+          node(sib).set_red();
+          x = x_parent;
+          x_parent = node(x).parent();
+          continue;
+        }
+        if (is_black(node(sib).right())) {
+          node(node(sib).left()).set_black();
+          node(sib).set_red();
+          rotate_right(sib);
+          sib = node(x_parent).right();
+        }
+        node(sib).swap_color(node(x_parent));
+        node(x_parent).set_black();
+        node(node(sib).right()).set_black();
+        rotate_left(x_parent);
+      } else {
+        index_type sib = node(x_parent).left();
+        if (is_red(sib)) {
+          node(sib).set_black();
+          node(x_parent).set_red();
+          rotate_right(x_parent);
+          sib = node(x_parent).left();
+        }
+        if (is_black(node(sib).left()) && is_black(node(sib).right())) {
+          node(sib).set_red();
+          x = x_parent;
+          x_parent = node(x).parent();
+          continue;
+        }
+        if (is_black(node(sib).left())) {
+          node(node(sib).right()).set_black();
+          node(sib).set_red();
+          rotate_left(sib);
+          sib = node(x_parent).left();
+        }
+        node(sib).swap_color(node(x_parent));
+        node(x_parent).set_black();
+        node(node(sib).left()).set_black();
+        rotate_right(x_parent);
+      }
+      x = root();
+    }
+    if (x != nil) node(x).set_black();
+  }
+
+#ifndef NDEBUG
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  bool check_parent(index_type n) const {
+    if (n == nil) return true;
+    index_type l = node(n).left(), r = node(n).right();
+    return (l == nil || node(l).parent() == n)
+        && (r == nil || node(r).parent() == n)
+        && check_parent(l) && check_parent(r);
+  }
+
+  bool check_reds_children(index_type n) const {
+    if (n == nil) return true;
+    if (is_red(n) && (is_red(node(n).left()) || is_red(node(n).right())))
+      return false;
+    return check_reds_children(node(n).left()) &&
+           check_reds_children(node(n).right());
+  }
+
+  std::pair<size_type, bool> check_black_height(index_type n) const {
+    if (n == nil) return {1, true};
+    auto lh = check_black_height(node(n).left());
+    if (!lh.second) return {0, false};
+    auto rh = check_black_height(node(n).right());
+    if (!rh.second || lh.first != rh.first) return {0, false};
+    return {is_black(n) + lh.first, true};
+  }
+#endif  //NDEBUG
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// non-member functions
+template <typename T, typename Compare>
+void swap(RBTreeCompact<T, Compare> &lhs,
+          RBTreeCompact<T, Compare> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_COMPACT_HPP_INCLUDED
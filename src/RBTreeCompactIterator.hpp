@@ -0,0 +1,138 @@
+#ifndef __RBTREE_COMPACT_ITERATOR_HPP_INCLUDED
+#define __RBTREE_COMPACT_ITERATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+template <typename, typename>
+class RBTreeCompactIterator;
+#include <RBTreeCompactNode.hpp>
+
+template <typename, typename, typename>
+class RBTreeCompact;
+
+template <typename T, typename Enable = void>
+class RBTreeCompactIterator;
+
+// (node vector, index) pair; slot 0 of the vector is the header whose left
+// link is the root, and doubles as end()
+template <typename T>
+class RBTreeCompactIterator<T,
+      typename std::enable_if<std::is_const<T>::value>::type> {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// iterator traits
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename std::remove_const<T>::type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
+
+///////////////////////////////////////////////////////////////////////////////
+// friends
+  template <typename T1, typename T2, typename T3>
+  friend class RBTreeCompact;
+  template <typename T1, typename T2>
+  friend bool operator==(const RBTreeCompactIterator<T1> &,
+                         const RBTreeCompactIterator<T2> &) noexcept;
+
+private:
+  using Node = RBTreeCompactNode<value_type>;
+  using index_type = typename Node::index_type;
+  using Nodes = std::vector<Node>;
+
+  static constexpr index_type nil = Node::nil;
+  static constexpr index_type header = 0;
+
+  RBTreeCompactIterator(const Nodes *nodes, index_type idx) noexcept
+    : _nodes(nodes), _idx(idx) {}
+
+  const Node &node(index_type i) const noexcept {return (*_nodes)[i];}
+
+public:
+  constexpr RBTreeCompactIterator() noexcept {}
+
+  reference operator*() const noexcept {return node(_idx).value();}
+  pointer operator->() const noexcept {return &node(_idx).value();}
+
+  RBTreeCompactIterator &operator++() noexcept {
+    if (node(_idx).right() != nil) {
+      _idx = node(_idx).right();
+      while (node(_idx).left() != nil) _idx = node(_idx).left();
+    } else {
+      index_type p = node(_idx).parent();
+      while (p != nil && node(p).right() == _idx) {
+        _idx = p;
+        p = node(p).parent();
+      }
+      _idx = p == nil ? header : p;
+    }
+    return *this;
+  }
+  RBTreeCompactIterator &operator--() noexcept {
+    if (_idx == header) {
+      _idx = node(header).left();
+      while (node(_idx).right() != nil) _idx = node(_idx).right();
+    } else if (node(_idx).left() != nil) {
+      _idx = node(_idx).left();
+      while (node(_idx).right() != nil) _idx = node(_idx).right();
+    } else {
+      index_type p = node(_idx).parent();
+      while (node(p).left() == _idx) {
+        _idx = p;
+        p = node(p).parent();
+      }
+      _idx = p;
+    }
+    return *this;
+  }
+  RBTreeCompactIterator operator++(int) noexcept {
+    RBTreeCompactIterator other(*this); ++*this; return other;}
+  RBTreeCompactIterator operator--(int) noexcept {
+    RBTreeCompactIterator other(*this); --*this; return other;}
+
+  void swap(RBTreeCompactIterator &other) noexcept {
+    using std::swap;
+    swap(_nodes, other._nodes);
+    swap(_idx, other._idx);
+  }
+
+private:
+  const Nodes *_nodes = nullptr;
+  index_type _idx = header;
+};
+
+template <typename T>
+constexpr typename RBTreeCompactIterator<T,
+  typename std::enable_if<std::is_const<T>::value>::type>::index_type
+  RBTreeCompactIterator<T,
+  typename std::enable_if<std::is_const<T>::value>::type>::nil;
+template <typename T>
+constexpr typename RBTreeCompactIterator<T,
+  typename std::enable_if<std::is_const<T>::value>::type>::index_type
+  RBTreeCompactIterator<T,
+  typename std::enable_if<std::is_const<T>::value>::type>::header;
+
+template <typename T, typename U>
+bool operator==(const RBTreeCompactIterator<T> &lhs,
+                const RBTreeCompactIterator<U> &rhs) noexcept
+{
+  return lhs._nodes == rhs._nodes && lhs._idx == rhs._idx;
+}
+
+template <typename T, typename U>
+bool operator!=(const RBTreeCompactIterator<T> &lhs,
+                const RBTreeCompactIterator<U> &rhs) noexcept
+{
+  return !(lhs == rhs);
+}
+
+template <typename T>
+void swap(RBTreeCompactIterator<T> &lhs,
+          RBTreeCompactIterator<T> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_COMPACT_ITERATOR_HPP_INCLUDED
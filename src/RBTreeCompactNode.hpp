@@ -0,0 +1,74 @@
+#ifndef __RBTREE_COMPACT_NODE_HPP_INCLUDED
+#define __RBTREE_COMPACT_NODE_HPP_INCLUDED
+
+#include <cstdint>
+#include <utility>
+template <typename>
+class RBTreeCompactNode;
+
+// node of RBTreeCompact: lives in a contiguous node vector and links to
+// other nodes by 32-bit index; the color is the top bit of the parent index
+template <typename T>
+class RBTreeCompactNode {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using index_type = std::uint32_t;
+
+  static constexpr index_type nil = 0x7fffffffu;
+
+private:
+  static constexpr index_type BLACK_BIT = 0x80000000u;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  RBTreeCompactNode() : _value() {}
+  RBTreeCompactNode(const value_type &value) : _value(value) {}
+
+///////////////////////////////////////////////////////////////////////////////
+// query/modifier
+  reference value() noexcept {return _value;}
+  const_reference value() const noexcept {return _value;}
+
+  void set_red() noexcept {_parent_color &= ~BLACK_BIT;}
+  void set_black() noexcept {_parent_color |= BLACK_BIT;}
+  bool is_red() const noexcept {return !(_parent_color & BLACK_BIT);}
+  bool is_black() const noexcept {return _parent_color & BLACK_BIT;}
+  void swap_color(RBTreeCompactNode &other) noexcept {
+    index_type diff = (_parent_color ^ other._parent_color) & BLACK_BIT;
+    _parent_color ^= diff;
+    other._parent_color ^= diff;
+  }
+
+  bool is_root() const noexcept {return parent() == nil;}
+
+///////////////////////////////////////////////////////////////////////////////
+// node operations
+  index_type &left() noexcept {return _left;}
+  index_type left() const noexcept {return _left;}
+  index_type &right() noexcept {return _right;}
+  index_type right() const noexcept {return _right;}
+
+  index_type parent() const noexcept {return _parent_color & ~BLACK_BIT;}
+  void set_parent(index_type p) noexcept
+  {_parent_color = (_parent_color & BLACK_BIT) | p;}
+
+private:
+  value_type _value;
+
+  index_type _left = nil;
+  index_type _right = nil;
+  index_type _parent_color = nil; // red, no parent
+};
+
+template <typename T>
+constexpr typename RBTreeCompactNode<T>::index_type RBTreeCompactNode<T>::nil;
+template <typename T>
+constexpr typename RBTreeCompactNode<T>::index_type
+  RBTreeCompactNode<T>::BLACK_BIT;
+
+#endif // __RBTREE_COMPACT_NODE_HPP_INCLUDED
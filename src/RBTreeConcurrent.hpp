@@ -0,0 +1,570 @@
+#ifndef __RBTREE_CONCURRENT_HPP_INCLUDED
+#define __RBTREE_CONCURRENT_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+template <typename, typename, typename>
+class RBTreeConcurrent;
+#include <RBTree.hpp>
+#include <RBTreeConcurrentNode.hpp>
+#include <RBTreeEpoch.hpp>
+#include <RBTreeStripedLock.hpp>
+
+// ordered set that many threads may read and write at once
+//
+// Writers couple locks on the way down: a writer locks a child before it
+// lets go of the parent. Insertion and erasure are the top-down red-black
+// algorithms, which recolour and rotate while descending, so a writer
+// only ever holds a window of a few nodes around its position (up to the
+// grandparent's parent, the sibling and the children of both) and no
+// fix-up walks back up. Writers in different subtrees run in parallel;
+// they meet only where their paths still overlap, near the root, and
+// there they follow each other down. Erase also keeps the node it removes
+// and that node's parent locked until the in-order predecessor has been
+// moved into its place.
+//
+// Readers take no locks and write nothing shared. They validate each
+// step: read the node's version, the link, the child's version, and check
+// that the node's version has not moved; a writer sets a node dirty
+// before changing its links, and a reader that meets a dirty or changed
+// node starts over. Values never change once in a node, so comparing them
+// needs no lock. Erased nodes are freed once RBTreeEpoch shows no reader
+// can still be on them. find and contains are linearizable; a bound was
+// in the set during the call, and nothing closer to value was in it
+// throughout the call.
+//
+// Locks are always taken parent first, so writers never wait in a cycle.
+// clear() and snapshot() keep writers out through a striped lock whose
+// shared side each write takes on a cache line of its own. Iterators
+// would dangle, so lookups copy the element out instead. The allocator is
+// called from several threads at once and must be thread safe.
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class RBTreeConcurrent {
+  static_assert(!std::is_reference<T>::value,
+      "RBTreeConcurrent needs a value type");
+
+  using Links = RBTreeConcurrentLinks;
+  using pLinks = Links*;
+  using version_type = Links::version_type;
+  using Node = RBTreeConcurrentNode<T>;
+  using pNode = Node*;
+  using node_allocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<Node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+  static_assert(std::is_same<typename node_traits::pointer, pNode>::value,
+      "fancy allocator pointers are not supported");
+  using Lock = RBTreeStripedLock<>;
+  using ShareLock = std::shared_lock<Lock>;
+  using WholeLock = std::lock_guard<Lock>;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using tree_type = RBTree<T, Compare, Allocator>;
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using size_type = std::size_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  explicit RBTreeConcurrent(const Compare& comp = Compare(),
+                            const Allocator& alloc = Allocator())
+    : _comp(comp), _alloc(alloc) {}
+  template <class InputIt>
+  RBTreeConcurrent(InputIt first, InputIt last,
+                   const Compare& comp = Compare(),
+                   const Allocator& alloc = Allocator())
+    : RBTreeConcurrent(comp, alloc) {
+    try {
+      for (; first != last; ++first) insert(*first);
+    } catch (...) {
+      destroy_subtree(root());
+      throw;
+    }
+  }
+  RBTreeConcurrent(const RBTreeConcurrent &) = delete;
+  RBTreeConcurrent &operator=(const RBTreeConcurrent &) = delete;
+
+  ~RBTreeConcurrent() noexcept {
+    destroy_subtree(root());
+    for (auto &limbo : _limbo)
+      for (pNode n : limbo) destroy_node(n);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return !size();}
+  size_type size() const noexcept {
+    return _size.load(std::memory_order_relaxed);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  // waits for the readers still in the old tree before freeing it
+  void clear() {
+    pLinks old;
+    {
+      WholeLock whole(_lock);
+      _head.lock();
+      old = root();
+      _head.set_link(true, nullptr);
+      _head.unlock();
+      _size.store(0, std::memory_order_relaxed);
+    }
+    {
+      std::lock_guard<std::mutex> lock(_limbo_lock);
+      wait_for_readers();
+    }
+    destroy_subtree(old);
+  }
+
+  // true if inserted; the node is only made once the search reaches the
+  // place it goes
+  bool insert(const_reference value) {
+    if (contains(value)) return false;
+    return insert_at(value, [this, &value] {return create_node(value);});
+  }
+  bool insert(value_type &&value) {
+    if (contains(value)) return false;
+    return insert_at(value, [this, &value] {
+      return create_node(std::move(value));
+    });
+  }
+  template <typename... Args>
+  bool emplace(Args && ... args) {
+    pNode node = create_node(std::forward<Args>(args)...);
+    bool inserted = false;
+    try {
+      inserted = !contains(node->value())
+        && insert_at(node->value(), [node] {return node;});
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    if (!inserted) destroy_node(node);
+    return inserted;
+  }
+
+  size_type erase(const_reference value) {
+    if (!contains(value)) return 0;
+    pNode gone = erase_node(value);
+    if (!gone) return 0;
+    retire(gone);
+    return 1;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  size_type count(const_reference value) const {return contains(value);}
+  bool contains(const_reference value) const {
+    Reading reading(_epoch);
+    return find_node(value);
+  }
+
+  // copy the element found into out, if any
+  bool find(const_reference value, reference out) const {
+    Reading reading(_epoch);
+    pLinks n = find_node(value);
+    if (!n) return false;
+    out = value_of(n);
+    return true;
+  }
+  bool lower_bound(const_reference value, reference out) const {
+    Reading reading(_epoch);
+    pLinks n = descend([this, &value](pLinks n) {
+      return _comp(value_of(n), value) ? 1 : 0;
+    }).second;
+    if (!n) return false;
+    out = value_of(n);
+    return true;
+  }
+  bool upper_bound(const_reference value, reference out) const {
+    Reading reading(_epoch);
+    pLinks n = descend([this, &value](pLinks n) {
+      return _comp(value, value_of(n)) ? 0 : 1;
+    }).second;
+    if (!n) return false;
+    out = value_of(n);
+    return true;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// whole tree
+  // an RBTree with the contents, taken while writers wait
+  tree_type snapshot() const {
+    WholeLock whole(_lock);
+    std::vector<T> values;
+    values.reserve(size());
+    collect(root(), values);
+    return tree_type(sorted_unique, values.begin(), values.end(), _comp,
+                     Allocator(_alloc));
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  value_compare value_comp() const {return _comp;}
+  allocator_type get_allocator() const {return allocator_type(_alloc);}
+
+#ifndef NDEBUG
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  // only while no other thread uses the tree
+  bool is_valid_rb_tree() const {
+    return !is_red(root()) && check(root(), nullptr, nullptr).second;
+  }
+#endif  //NDEBUG
+
+private:
+  // the nodes a writer has locked, all unlocked when it leaves
+  class Held {
+  public:
+    Held() = default;
+    Held(const Held &) = delete;
+    ~Held() noexcept {
+      while (_count) _nodes[--_count]->unlock();
+    }
+
+    // lock n, unless it is null or held already
+    void lock(pLinks n) noexcept {
+      if (!n || holds(n)) return;
+      n->lock();
+      _nodes[_count++] = n;
+    }
+    // unlock all but the given nodes
+    template <typename... Nodes>
+    void keep(Nodes... nodes) noexcept {
+      const pLinks kept[] = {nodes...};
+      for (std::size_t i = 0; i != _count; ) {
+        if (std::find(std::begin(kept), std::end(kept), _nodes[i])
+            != std::end(kept)) {
+          ++i;
+          continue;
+        }
+        _nodes[i]->unlock();
+        _nodes[i] = _nodes[--_count];
+      }
+    }
+
+  private:
+    bool holds(pLinks n) const noexcept {
+      return std::find(_nodes, _nodes + _count, n) != _nodes + _count;
+    }
+
+    // erase holds the node to remove and its parent, g, p, q, the
+    // sibling s and the children of q and s: ten at most
+    pLinks _nodes[12];
+    std::size_t _count = 0;
+  };
+
+  // counts a reader in with the epoch for as long as it lives
+  struct Reading {
+    explicit Reading(RBTreeEpoch<> &epoch) noexcept
+      : epoch(epoch), parity(epoch.enter()) {}
+    ~Reading() noexcept {epoch.exit(parity);}
+    RBTreeEpoch<> &epoch;
+    std::size_t parity;
+  };
+
+  mutable Links _head; // right link is the root
+  std::atomic<size_type> _size {0};
+  mutable Lock _lock;
+  mutable RBTreeEpoch<> _epoch;
+  std::vector<pNode> _limbo[2]; // erased during even and odd epochs
+  std::mutex _limbo_lock;
+  Compare _comp;
+  node_allocator _alloc;
+
+///////////////////////////////////////////////////////////////////////////////
+// node access
+  pLinks root() const noexcept {return _head.link(true);}
+
+  static const_reference value_of(pLinks n) noexcept {
+    return static_cast<pNode>(n)->value();
+  }
+  static bool is_red(pLinks n) noexcept {return n && n->is_red();}
+
+///////////////////////////////////////////////////////////////////////////////
+// node allocation
+  template <typename... Args>
+  pNode create_node(Args && ... args) {
+    pNode p = node_traits::allocate(_alloc, 1);
+    try {
+      node_traits::construct(_alloc, p, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(_alloc, p, 1);
+      throw;
+    }
+    return p;
+  }
+
+  void destroy_node(pNode p) noexcept {
+    node_traits::destroy(_alloc, p);
+    node_traits::deallocate(_alloc, p, 1);
+  }
+
+  void destroy_subtree(pLinks n) noexcept {
+    if (!n) return;
+    destroy_subtree(n->link(false));
+    destroy_subtree(n->link(true));
+    destroy_node(static_cast<pNode>(n));
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// reclamation
+  // free n once no reader can still be on it
+  void retire(pNode n) noexcept {
+    std::lock_guard<std::mutex> lock(_limbo_lock);
+    try {
+      _limbo[_epoch.epoch() & 1].push_back(n);
+    } catch (...) {
+      // cannot defer it, so wait it out
+      wait_for_readers();
+      destroy_node(n);
+      return;
+    }
+    advance();
+  }
+
+  // a node retired during e - 1 is freed when moving past e; with
+  // _limbo_lock held
+  bool advance() noexcept {
+    std::size_t parity = (_epoch.epoch() + 1) & 1;
+    if (!_epoch.try_advance()) return false;
+    for (pNode n : _limbo[parity]) destroy_node(n);
+    _limbo[parity].clear();
+    return true;
+  }
+
+  // until every reader there is now has left; with _limbo_lock held
+  void wait_for_readers() noexcept {
+    std::size_t e = _epoch.epoch();
+    while (_epoch.epoch() < e + 2)
+      if (!advance()) std::this_thread::yield();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// balancing
+  // the child away from dir comes up, the old top goes down red
+  static pLinks rotate(pLinks top, bool dir) noexcept {
+    pLinks up = top->link(!dir);
+    top->set_link(!dir, up->link(dir));
+    up->set_link(dir, top);
+    top->set_red();
+    up->set_black();
+    return up;
+  }
+  static pLinks rotate_twice(pLinks top, bool dir) noexcept {
+    top->set_link(!dir, rotate(top->link(!dir), !dir));
+    return rotate(top, dir);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// insertion/removal
+  // make() is called once the place is found and must return a node
+  // holding value
+  template <class Make>
+  bool insert_at(const_reference value, Make make) {
+    ShareLock share(_lock);
+    Held held;
+    pLinks t = &_head, g = nullptr, p = nullptr;
+    bool dir = true, last = true, inserted = false;
+    held.lock(t);
+    pLinks q = root();
+    if (!q) {
+      q = make();
+      q->set_black();
+      _head.set_link(true, q);
+      _size.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    held.lock(q);
+    while (true) {
+      if (!q) {
+        q = make();
+        held.lock(q);
+        p->set_link(dir, q);
+        inserted = true;
+      } else {
+        held.lock(q->link(false));
+        held.lock(q->link(true));
+        // split a 4-node on the way down, so there is room below
+        if (is_red(q->link(false)) && is_red(q->link(true))) {
+          q->set_red();
+          q->link(false)->set_black();
+          q->link(true)->set_black();
+          if (!p) q->set_black();
+        }
+      }
+      // a red q under a red p, which is not the root, so g is a node
+      if (is_red(q) && is_red(p)) {
+        bool dir2 = t->link(true) == g;
+        if (q == p->link(last)) t->set_link(dir2, rotate(g, !last));
+        else t->set_link(dir2, rotate_twice(g, !last));
+      }
+      if (inserted) break;
+      bool less = _comp(value_of(q), value);
+      if (!less && !_comp(value, value_of(q))) return false;
+      last = dir;
+      dir = less;
+      if (g) t = g;
+      g = p;
+      p = q;
+      q = q->link(dir);
+      held.keep(t, g, p, q);
+    }
+    _size.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // unlink the node holding value, if any, and return it
+  pNode erase_node(const_reference value) {
+    ShareLock share(_lock);
+    Held held;
+    pLinks g = nullptr, p = nullptr, q = &_head;
+    pLinks f = nullptr, fp = nullptr; // the node holding value, its parent
+    bool dir = true;
+    held.lock(q);
+    while (q->link(dir)) {
+      bool last = dir;
+      g = p;
+      p = q;
+      q = q->link(dir);
+      held.lock(q); // the root; every other q is locked already
+      dir = _comp(value_of(q), value);
+      if (!dir && !_comp(value, value_of(q))) {
+        f = q;
+        fp = p;
+      }
+      held.lock(q->link(false));
+      held.lock(q->link(true));
+      pLinks s = p->link(!last);
+      held.lock(s);
+      if (s) {
+        held.lock(s->link(false));
+        held.lock(s->link(true));
+      }
+
+      // make q red, so it can go, by pulling a red down from above
+      if (!is_red(q) && !is_red(q->link(dir))) {
+        if (is_red(q->link(!dir))) {
+          pLinks up = rotate(q, dir);
+          p->set_link(last, up);
+          p = up;
+          if (q == f) fp = up;
+        } else if (s) {
+          if (!is_red(s->link(!last)) && !is_red(s->link(last))) {
+            p->set_black();
+            s->set_red();
+            q->set_red();
+          } else {
+            bool dir2 = g->link(true) == p;
+            pLinks top = is_red(s->link(last)) ? rotate_twice(p, last)
+                                               : rotate(p, last);
+            g->set_link(dir2, top);
+            if (p == f) fp = top;
+            q->set_red();
+            top->set_red();
+            top->link(false)->set_black();
+            top->link(true)->set_black();
+            if (g == &_head) top->set_black();
+          }
+        }
+      }
+      held.keep(f, fp, p, q, q->link(false), q->link(true));
+    }
+
+    if (!f) return nullptr;
+    // q is f or the in-order predecessor of f and has one child at most;
+    // it leaves its place, and takes f's if that is not the same
+    p->set_link(p->link(true) == q, q->link(!q->link(false)));
+    if (f != q) {
+      q->set_link(false, f->link(false));
+      q->set_link(true, f->link(true));
+      q->set_color_of(f);
+      fp->set_link(fp->link(true) == f, q);
+      f->touch();
+    }
+    if (pLinks r = root()) {
+      if (fp == &_head || p == &_head) r->set_black();
+    }
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    return static_cast<pNode>(f);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  pLinks find_node(const_reference value) const {
+    return descend([this, &value](pLinks n) {
+      if (_comp(value_of(n), value)) return 1;
+      return _comp(value, value_of(n)) ? 0 : -1;
+    }).first;
+  }
+
+  // walk down from the root without locks, inside a Reading; go(node) is
+  // 0 to go left, 1 to go right, -1 to stop there. Returns the node it
+  // stopped at, null if it ran off the tree, and the last node it went
+  // left at.
+  template <class Go>
+  std::pair<pLinks, pLinks> descend(Go go) const {
+    while (true) {
+      pLinks n = &_head, left_at = nullptr;
+      version_type version;
+      int step = 1;
+      bool valid = n->read_version(version);
+      while (valid) {
+        pLinks child = n->link(step);
+        if (!n->validate(version)) break;
+        if (!child) return {nullptr, left_at};
+        version_type child_version;
+        valid = child->read_version(child_version)
+          && n->validate(version);
+        if (!valid) break;
+        step = go(child);
+        if (step < 0) return {child, left_at};
+        if (!step) left_at = child;
+        n = child;
+        version = child_version;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  void collect(pLinks n, std::vector<T> &values) const {
+    if (!n) return;
+    collect(n->link(false), values);
+    values.push_back(value_of(n));
+    collect(n->link(true), values);
+  }
+
+#ifndef NDEBUG
+  // (black height, valid) of the subtree at n, whose values lie within
+  // (lo, hi) where given
+  std::pair<std::size_t, bool> check(pLinks n, pLinks lo, pLinks hi) const {
+    if (!n) return {1, true};
+    if (lo && !_comp(value_of(lo), value_of(n))) return {0, false};
+    if (hi && !_comp(value_of(n), value_of(hi))) return {0, false};
+    if (is_red(n) && (is_red(n->link(false)) || is_red(n->link(true))))
+      return {0, false};
+    auto l = check(n->link(false), lo, n);
+    auto r = check(n->link(true), n, hi);
+    if (!l.second || !r.second || l.first != r.first) return {0, false};
+    return {l.first + n->is_black(), true};
+  }
+#endif  //NDEBUG
+};
+
+#endif // __RBTREE_CONCURRENT_HPP_INCLUDED
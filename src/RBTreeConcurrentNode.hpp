@@ -0,0 +1,128 @@
+#ifndef __RBTREE_CONCURRENT_NODE_HPP_INCLUDED
+#define __RBTREE_CONCURRENT_NODE_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <utility>
+class RBTreeConcurrentLinks;
+template <typename>
+class RBTreeConcurrentNode;
+
+// links, color and lock of an RBTreeConcurrent node; the tree's head is
+// one of these without a value, its right link is the root
+//
+// Writers lock a node to change it and read its color. Readers take no
+// lock: they read a version, the links, and check the version again. The
+// word holds the writer's lock bit, a dirty bit that is set before the
+// first link changes and the version, which moves on when a dirty node is
+// unlocked. A writer that only passes through leaves the version alone.
+class RBTreeConcurrentLinks {
+  using pLinks = RBTreeConcurrentLinks*;
+
+public:
+  using version_type = std::uint32_t;
+
+private:
+  static constexpr version_type LOCKED = 1;
+  static constexpr version_type DIRTY = 2;
+  static constexpr version_type STEP = 4;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  RBTreeConcurrentLinks() = default;
+  RBTreeConcurrentLinks(const RBTreeConcurrentLinks &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// query/modifier, for writers holding the lock
+  void set_red() noexcept {_red = true;}
+  void set_black() noexcept {_red = false;}
+  void set_color_of(const RBTreeConcurrentLinks *other) noexcept
+  {_red = other->_red;}
+  bool is_red() const noexcept {return _red;}
+  bool is_black() const noexcept {return !_red;}
+
+///////////////////////////////////////////////////////////////////////////////
+// node operations
+  // link(false) is the left child, link(true) the right one
+  pLinks link(bool dir) const noexcept {
+    return _link[dir].load(std::memory_order_acquire);
+  }
+  // readers that saw the old link will fail to validate
+  void set_link(bool dir, pLinks n) noexcept {
+    touch();
+    _link[dir].store(n, std::memory_order_release);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// writers
+  void lock() noexcept {
+    while (true) {
+      version_type word = _word.load(std::memory_order_relaxed);
+      if (!(word & LOCKED) && _word.compare_exchange_weak(word,
+            word | LOCKED, std::memory_order_acquire,
+            std::memory_order_relaxed))
+        return;
+      std::this_thread::yield();
+    }
+  }
+  void unlock() noexcept {
+    version_type word = _word.load(std::memory_order_relaxed);
+    if (word & DIRTY) word = (word & ~(LOCKED | DIRTY)) + STEP;
+    else word &= ~LOCKED;
+    _word.store(word, std::memory_order_release);
+  }
+
+  // mark the node as changing, before the first change under this lock;
+  // it is already locked, so nobody else stores to the word
+  void touch() noexcept {
+    version_type word = _word.load(std::memory_order_relaxed);
+    if (word & DIRTY) return;
+    _word.store(word | DIRTY, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// readers
+  // what the node looks like now; false if it is being changed
+  bool read_version(version_type &version) const noexcept {
+    version = _word.load(std::memory_order_acquire) & ~LOCKED;
+    return !(version & DIRTY);
+  }
+  // nothing read since read_version() gave version has changed
+  bool validate(version_type version) const noexcept {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (_word.load(std::memory_order_relaxed) & ~LOCKED) == version;
+  }
+
+private:
+  std::atomic<pLinks> _link[2] {{nullptr}, {nullptr}};
+  std::atomic<version_type> _word {0};
+  bool _red = false;
+};
+
+template <typename T>
+class RBTreeConcurrentNode : public RBTreeConcurrentLinks {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using const_reference = const value_type&;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  template <typename... Args>
+  explicit RBTreeConcurrentNode(Args && ... args)
+    : _value(std::forward<Args>(args)...) {set_red();}
+
+///////////////////////////////////////////////////////////////////////////////
+// query
+  // never changes, readers may compare it without a lock
+  const_reference value() const noexcept {return _value;}
+
+private:
+  const value_type _value;
+};
+
+#endif // __RBTREE_CONCURRENT_NODE_HPP_INCLUDED
@@ -1,7 +1,7 @@
 #ifndef __RBTREE_DECLARE_HPP_INCLUDED
 #define __RBTREE_DECLARE_HPP_INCLUDED
 
-template <typename, typename, typename>
+template <typename, typename, typename, typename, typename>
 class RBTree;
 
 #endif // __RBTREE_DECLARE_HPP_INCLUDED
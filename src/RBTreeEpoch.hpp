@@ -0,0 +1,72 @@
+#ifndef __RBTREE_EPOCH_HPP_INCLUDED
+#define __RBTREE_EPOCH_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+template <std::size_t>
+class RBTreeEpoch;
+
+// epoch counter for deferred reclamation
+//
+// A reader counts itself in under the parity of the epoch it saw and out
+// again when done; both are a single atomic add on a cache line of its
+// own stripe, it never waits and never retries. The epoch moves on from
+// e only once nobody is counted under the parity of e - 1, so whatever
+// was unlinked during e - 1 is unreachable after the move.
+template <std::size_t Stripes = 64>
+class RBTreeEpoch {
+  static_assert(Stripes > 0, "Stripes must be positive");
+
+public:
+  RBTreeEpoch() = default;
+  RBTreeEpoch(const RBTreeEpoch &) = delete;
+  RBTreeEpoch &operator=(const RBTreeEpoch &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// readers
+  // returns what exit() takes
+  std::size_t enter() noexcept {
+    std::size_t parity = _epoch.load() & 1;
+    _stripes[stripe()].readers[parity].fetch_add(1);
+    return parity;
+  }
+  void exit(std::size_t parity) noexcept {
+    _stripes[stripe()].readers[parity].fetch_sub(1,
+        std::memory_order_release);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// reclaimer
+  std::size_t epoch() const noexcept {return _epoch.load();}
+
+  // move from epoch e to e + 1 if the readers of e - 1 are gone, after
+  // which what was retired during e - 1 may be freed
+  bool try_advance() noexcept {
+    std::size_t e = _epoch.load();
+    std::size_t parity = (e + 1) & 1;
+    for (auto &s : _stripes)
+      if (s.readers[parity].load()) return false;
+    _epoch.store(e + 1);
+    return true;
+  }
+
+private:
+  // padded like RBTreeStripedLock's
+  struct Stripe {
+    std::atomic<std::size_t> readers[2] {{0}, {0}};
+    char pad[64 - 2 * sizeof(std::atomic<std::size_t>)];
+  };
+
+  // threads are dealt stripes round robin, once
+  static std::size_t stripe() noexcept {
+    static std::atomic<std::size_t> next {0};
+    static thread_local std::size_t mine =
+      next.fetch_add(1, std::memory_order_relaxed) % Stripes;
+    return mine;
+  }
+
+  Stripe _stripes[Stripes];
+  std::atomic<std::size_t> _epoch {0};
+};
+
+#endif // __RBTREE_EPOCH_HPP_INCLUDED
@@ -0,0 +1,203 @@
+#ifndef __RBTREE_FROZEN_HPP_INCLUDED
+#define __RBTREE_FROZEN_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+template <typename, typename, typename>
+class RBTreeFrozen;
+#include <RBTreeAugment.hpp>
+#include <RBTreeFrozenIterator.hpp>
+#include <RBTree.hpp>
+
+// immutable sorted set in one array, laid out for lookups
+//
+// The keys are stored in BFS (Eytzinger) order from index 1. Index 0 is
+// never searched: it keeps the children of k at 2k and 2k + 1 with no
+// offset in the search loop, and a settled index of 0 means end(); it
+// holds a copy of a key, so T needs no default constructor. A search
+// goes k -> 2k or 2k + 1 by adding the comparison to 2k, with no
+// branch on the outcome and no pointers, and prefetches the cache line
+// of k's descendants a few levels down, which are contiguous. The answer
+// is recovered from the final k by dropping its trailing ones. Made by
+// RBTree::freeze(), turned back into a tree by thaw(), both O(n).
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class RBTreeFrozen {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using iterator = RBTreeFrozenIterator<const T>;
+  using const_iterator = RBTreeFrozenIterator<const T>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using size_type = std::size_t;
+  using difference_type = typename iterator::difference_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  explicit RBTreeFrozen(const Compare& comp = Compare(),
+                        const Allocator& alloc = Allocator())
+    : _keys(alloc), _comp(comp) {}
+  // O(n), [first, last) must be sorted by comp without duplicates
+  template <class ForwardIt>
+  RBTreeFrozen(RBTreeSortedUnique, ForwardIt first, ForwardIt last,
+               const Compare& comp = Compare(),
+               const Allocator& alloc = Allocator())
+    : RBTreeFrozen(comp, alloc) {
+    size_type n = std::distance(first, last);
+    if (!n) return;
+    _keys.assign(n + 1, *first);
+    fill(1, first);
+  }
+
+  // the same keys back in an RBTree
+  template <typename Augment = RBTreeNoAugment>
+  RBTree<T, Compare, Allocator, Augment> thaw() const {
+    return RBTree<T, Compare, Allocator, Augment>(
+        sorted_unique, begin(), end(), _comp, _keys.get_allocator());
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// iterators
+  const_iterator begin() const noexcept {return cbegin();}
+  const_iterator end() const noexcept {return cend();}
+  const_iterator cbegin() const noexcept {return at(iterator::first(size()));}
+  const_iterator cend() const noexcept {return at(0);}
+  const_reverse_iterator rbegin() const noexcept {return crbegin();}
+  const_reverse_iterator rend() const noexcept {return crend();}
+  const_reverse_iterator crbegin() const noexcept
+  {return const_reverse_iterator(cend());}
+  const_reverse_iterator crend() const noexcept
+  {return const_reverse_iterator(cbegin());}
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return _keys.empty();}
+  size_type size() const noexcept {
+    return _keys.empty() ? 0 : _keys.size() - 1;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  const_iterator find(const_reference value) const {
+    size_type k = lower_bound_index(value);
+    return at(k && !_comp(value, _keys[k]) ? k : 0);
+  }
+
+  size_type count(const_reference value) const {
+    return find(value) != cend();
+  }
+
+  bool contains(const_reference value) const {
+    return find(value) != cend();
+  }
+
+  const_iterator lower_bound(const_reference value) const {
+    return at(lower_bound_index(value));
+  }
+
+  const_iterator upper_bound(const_reference value) const {
+    const T *keys = _keys.data();
+    size_type n = size(), k = 1;
+    while (k <= n) {
+      prefetch(keys + std::min(k * ahead, n));
+      k = 2 * k + !_comp(value, keys[k]);
+    }
+    return at(settle(k));
+  }
+
+  std::pair<const_iterator, const_iterator>
+    equal_range(const_reference value) const {
+    const_iterator lower = lower_bound(value);
+    if (lower == cend() || _comp(value, *lower)) return {lower, lower};
+    return {lower, std::next(lower)};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  value_compare value_comp() const {return _comp;}
+  allocator_type get_allocator() const {return _keys.get_allocator();}
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void swap(RBTreeFrozen &other) noexcept {
+    using std::swap;
+    swap(_keys, other._keys);
+    swap(_comp, other._comp);
+  }
+
+private:
+  // descendants this many levels apart share a 64-byte line, more or less
+  static constexpr size_type ahead_of(size_type keys_per_line) noexcept {
+    return keys_per_line < 4 ? 2 : 2 * ahead_of(keys_per_line / 2);
+  }
+  static constexpr size_type ahead = ahead_of(64 / sizeof(T));
+
+  static void prefetch(const T *p) noexcept {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+  }
+
+  // the answer is where the search last stepped left; climb back past
+  // the steps right taken after it, to 0 if there was none
+  static size_type settle(size_type k) noexcept {
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while (k & 1) k >>= 1;
+    return k >> 1;
+#endif
+  }
+
+  size_type lower_bound_index(const_reference value) const {
+    const T *keys = _keys.data();
+    size_type n = size(), k = 1;
+    while (k <= n) {
+      prefetch(keys + std::min(k * ahead, n));
+      k = 2 * k + _comp(keys[k], value);
+    }
+    return settle(k);
+  }
+
+  // an in-order walk of the subtree at k takes the keys in order
+  template <class ForwardIt>
+  void fill(size_type k, ForwardIt &first) {
+    if (k > size()) return;
+    fill(2 * k, first);
+    _keys[k] = *first++;
+    fill(2 * k + 1, first);
+  }
+
+  const_iterator at(size_type k) const noexcept {
+    return const_iterator(_keys.data(), size(), k);
+  }
+
+  std::vector<T, Allocator> _keys;
+  Compare _comp;
+};
+
+template <typename T, typename Compare, typename Allocator>
+constexpr typename RBTreeFrozen<T, Compare, Allocator>::size_type
+RBTreeFrozen<T, Compare, Allocator>::ahead;
+
+template <typename T, typename Compare, typename Allocator>
+void swap(RBTreeFrozen<T, Compare, Allocator> &lhs,
+          RBTreeFrozen<T, Compare, Allocator> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_FROZEN_HPP_INCLUDED
@@ -0,0 +1,127 @@
+#ifndef __RBTREE_FROZEN_ITERATOR_HPP_INCLUDED
+#define __RBTREE_FROZEN_ITERATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+template <typename, typename>
+class RBTreeFrozenIterator;
+
+template <typename, typename, typename>
+class RBTreeFrozen;
+
+template <typename T, typename Enable = void>
+class RBTreeFrozenIterator;
+
+// (key array, size, index) triple; the keys are in BFS order from index 1,
+// so k has children 2k and 2k + 1, and index 0 doubles as end()
+template <typename T>
+class RBTreeFrozenIterator<T,
+      typename std::enable_if<std::is_const<T>::value>::type> {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// iterator traits
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename std::remove_const<T>::type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
+
+///////////////////////////////////////////////////////////////////////////////
+// friends
+  template <typename T1, typename T2, typename T3>
+  friend class RBTreeFrozen;
+  template <typename T1, typename T2>
+  friend bool operator==(const RBTreeFrozenIterator<T1> &,
+                         const RBTreeFrozenIterator<T2> &) noexcept;
+
+private:
+  using size_type = std::size_t;
+
+  RBTreeFrozenIterator(T *keys, size_type n, size_type idx) noexcept
+    : _keys(keys), _n(n), _idx(idx) {}
+
+  // leftmost index, 0 if empty
+  static size_type first(size_type n) noexcept {
+    if (!n) return 0;
+    size_type k = 1;
+    while (2 * k <= n) k *= 2;
+    return k;
+  }
+  static size_type last(size_type n) noexcept {
+    if (!n) return 0;
+    size_type k = 1;
+    while (2 * k + 1 <= n) k = 2 * k + 1;
+    return k;
+  }
+  // in-order neighbours; climbing out past the root gives 0
+  static size_type next(size_type k, size_type n) noexcept {
+    if (2 * k + 1 <= n) {
+      k = 2 * k + 1;
+      while (2 * k <= n) k *= 2;
+      return k;
+    }
+    while (k & 1) k >>= 1;
+    return k >> 1;
+  }
+  static size_type prev(size_type k, size_type n) noexcept {
+    if (!k) return last(n);
+    if (2 * k <= n) {
+      k *= 2;
+      while (2 * k + 1 <= n) k = 2 * k + 1;
+      return k;
+    }
+    while (k && !(k & 1)) k >>= 1;
+    return k >> 1;
+  }
+
+public:
+  constexpr RBTreeFrozenIterator() noexcept {}
+
+  reference operator*() const noexcept {return _keys[_idx];}
+  pointer operator->() const noexcept {return _keys + _idx;}
+
+  RBTreeFrozenIterator &operator++() noexcept {
+    _idx = next(_idx, _n); return *this;}
+  RBTreeFrozenIterator &operator--() noexcept {
+    _idx = prev(_idx, _n); return *this;}
+  RBTreeFrozenIterator operator++(int) noexcept {
+    RBTreeFrozenIterator other(*this); ++*this; return other;}
+  RBTreeFrozenIterator operator--(int) noexcept {
+    RBTreeFrozenIterator other(*this); --*this; return other;}
+
+  void swap(RBTreeFrozenIterator &other) noexcept {
+    using std::swap;
+    swap(_keys, other._keys);
+    swap(_n, other._n);
+    swap(_idx, other._idx);
+  }
+
+private:
+  T *_keys = nullptr;
+  size_type _n = 0;
+  size_type _idx = 0;
+};
+
+template <typename T, typename U>
+bool operator==(const RBTreeFrozenIterator<T> &lhs,
+                const RBTreeFrozenIterator<U> &rhs) noexcept
+{
+  return lhs._keys == rhs._keys && lhs._idx == rhs._idx;
+}
+
+template <typename T, typename U>
+bool operator!=(const RBTreeFrozenIterator<T> &lhs,
+                const RBTreeFrozenIterator<U> &rhs) noexcept
+{
+  return !(lhs == rhs);
+}
+
+template <typename T>
+void swap(RBTreeFrozenIterator<T> &lhs,
+          RBTreeFrozenIterator<T> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_FROZEN_ITERATOR_HPP_INCLUDED
@@ -0,0 +1,202 @@
+#ifndef __RBTREE_INTERVAL_TREE_HPP_INCLUDED
+#define __RBTREE_INTERVAL_TREE_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+template <typename, typename, typename>
+class RBTreeIntervalTree;
+#include <RBTree.hpp>
+
+// orders [start, end) intervals by start, then end
+template <typename Key, typename Compare>
+struct RBTreeIntervalCompare {
+  bool operator()(const std::pair<Key, Key> &lhs,
+                  const std::pair<Key, Key> &rhs) const {
+    return comp(lhs.first, rhs.first) ||
+      (!comp(rhs.first, lhs.first) && comp(lhs.second, rhs.second));
+  }
+  Compare comp;
+};
+
+// largest end point in a subtree
+template <typename Key, typename Compare>
+struct RBTreeMaxEndAugment {
+  struct aggregate_type {
+    Key end = Key();
+    bool empty = true;
+  };
+
+  aggregate_type identity() const {return aggregate_type();}
+  aggregate_type lift(const std::pair<Key, Key> &value) const
+  {return {value.second, false};}
+  aggregate_type combine(const aggregate_type &lhs,
+                         const aggregate_type &rhs) const {
+    if (lhs.empty) return rhs;
+    if (rhs.empty) return lhs;
+    return comp(lhs.end, rhs.end) ? rhs : lhs;
+  }
+  Compare comp;
+};
+
+// Set of half-open intervals [start, end) with stabbing and overlap
+// queries. Elements are RBTree nodes ordered by (start, end), each keeping
+// the largest end in its subtree; a query skips every subtree that ends
+// too early or starts too late, so it costs O(log n) plus O(log n) per
+// reported interval at worst, and close to O(log n + k) when the results
+// sit next to each other.
+// Identical intervals are stored once; Compare must be stateless.
+template <typename Key, typename Compare = std::less<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Key>>>
+class RBTreeIntervalTree {
+  using Tree = RBTree<std::pair<Key, Key>,
+        RBTreeIntervalCompare<Key, Compare>, Allocator,
+        RBTreeMaxEndAugment<Key, Compare>>;
+  using cNode = typename Tree::cNode;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using key_type = Key;
+  using value_type = std::pair<Key, Key>;
+  using key_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using iterator = typename Tree::iterator;
+  using const_iterator = typename Tree::const_iterator;
+  using size_type = typename Tree::size_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  RBTreeIntervalTree() = default;
+  explicit RBTreeIntervalTree(const Allocator &alloc)
+    : _tree(typename Tree::value_compare(), alloc) {}
+  template <class InputIt>
+  RBTreeIntervalTree(InputIt first, InputIt last,
+                     const Allocator &alloc = Allocator())
+    : _tree(first, last, typename Tree::value_compare(), alloc) {}
+
+///////////////////////////////////////////////////////////////////////////////
+// iterators
+  const_iterator begin() const noexcept {return _tree.begin();}
+  const_iterator cbegin() const noexcept {return _tree.cbegin();}
+  const_iterator end() const noexcept {return _tree.end();}
+  const_iterator cend() const noexcept {return _tree.cend();}
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return _tree.empty();}
+  size_type size() const noexcept {return _tree.size();}
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void clear() noexcept {_tree.clear();}
+
+  std::pair<iterator, bool> insert(const_reference interval) {
+    return _tree.insert(interval);
+  }
+  std::pair<iterator, bool> insert(const key_type &start,
+                                   const key_type &end) {
+    return _tree.emplace(start, end);
+  }
+
+  iterator erase(const_iterator pos) {return _tree.erase(pos);}
+  size_type erase(const_reference interval) {return _tree.erase(interval);}
+  size_type erase(const key_type &start, const key_type &end) {
+    return _tree.erase(value_type(start, end));
+  }
+
+  void swap(RBTreeIntervalTree &other) noexcept {_tree.swap(other._tree);}
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  const_iterator find(const_reference interval) const {
+    return _tree.find(interval);
+  }
+  bool contains(const_reference interval) const {
+    return _tree.contains(interval);
+  }
+
+  // largest end point, undefined if empty
+  const key_type &max_end() const {return _tree._root->aggregate().end;}
+
+  // every interval containing point, in order, written to out
+  template <class OutputIt>
+  OutputIt stab(const key_type &point, OutputIt out) const {
+    visit(_tree._root, point, point, true, out);
+    return out;
+  }
+
+  // every interval overlapping [lo, hi), in order, written to out
+  template <class OutputIt>
+  OutputIt overlap(const key_type &lo, const key_type &hi,
+                   OutputIt out) const {
+    if (comp()(lo, hi)) visit(_tree._root, lo, hi, false, out);
+    return out;
+  }
+
+  // first interval overlapping [lo, hi), end() if none; O(log n)
+  const_iterator find_overlap(const key_type &lo, const key_type &hi) const {
+    if (!comp()(lo, hi)) return end();
+    cNode curr = _tree._root;
+    while (curr && ends_after(curr, lo)) {
+      if (ends_after(curr->left(), lo)) curr = curr->left();
+      else if (!starts_before(curr, hi, false)) break;
+      else if (comp()(lo, curr->value().second))
+        return Tree::iterator_to(curr);
+      else curr = curr->right();
+    }
+    return end();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  key_compare key_comp() const {return key_compare();}
+
+#ifndef NDEBUG
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  bool is_valid_rb_tree() const {return _tree.is_valid_rb_tree();}
+  bool check_parent() const {return _tree.check_parent();}
+#endif  //NDEBUG
+
+private:
+  Tree _tree;
+
+  static Compare comp() {return Compare();}
+
+  // some interval in the subtree of n ends after lo
+  static bool ends_after(cNode n, const key_type &lo) {
+    return n && comp()(lo, n->aggregate().end);
+  }
+
+  // n starts before hi, or at hi if closed
+  static bool starts_before(cNode n, const key_type &hi, bool closed) {
+    return closed ? !comp()(hi, n->value().first)
+                  : comp()(n->value().first, hi);
+  }
+
+  // in-order walk of the intervals with start before hi and end after lo
+  template <class OutputIt>
+  static void visit(cNode n, const key_type &lo, const key_type &hi,
+                    bool closed, OutputIt &out) {
+    while (ends_after(n, lo)) {
+      visit(n->left(), lo, hi, closed, out);
+      // n and its right subtree start too late
+      if (!starts_before(n, hi, closed)) return;
+      if (comp()(lo, n->value().second)) *out++ = n->value();
+      n = n->right();
+    }
+  }
+};
+
+template <typename Key, typename Compare, typename Allocator>
+void swap(RBTreeIntervalTree<Key, Compare, Allocator> &lhs,
+          RBTreeIntervalTree<Key, Compare, Allocator> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_INTERVAL_TREE_HPP_INCLUDED
@@ -4,17 +4,18 @@
 #include <cstddef>
 #include <iterator>
 #include <type_traits>
-template <typename, typename>
+template <typename, typename, typename>
 class RBTreeIterator;
+#include <RBTreeAugment.hpp>
 #include <RBTreeDeclare.hpp>
 #include <RBTreeNode.hpp>
-#include <RBTreeNodePointer.hpp>
 
-template <typename T, typename Enable = void>
+template <typename T, typename Augment = RBTreeNoAugment, 
+          typename Enable = void>
 class RBTreeIterator;
 
-template <typename T>
-class RBTreeIterator<T,
+template <typename T, typename Augment>
+class RBTreeIterator<T, Augment,
       typename std::enable_if<std::is_const<T>::value>::type> {
 public:
 ///////////////////////////////////////////////////////////////////////////////
@@ -27,38 +28,37 @@ public:
 
 ///////////////////////////////////////////////////////////////////////////////
 // friends
-  template <typename T1, typename T2, typename T3>
+  template <typename T1, typename T2, typename T3, typename T4, 
+            typename T5>
   friend class RBTree;
-  template <typename T1, typename T2>
-  friend bool operator==(const RBTreeIterator<T1> &, 
-                         const RBTreeIterator<T2> &) noexcept;
+  template <typename T1, typename T2, typename A>
+  friend bool operator==(const RBTreeIterator<T1, A> &, 
+                         const RBTreeIterator<T2, A> &) noexcept;
 #ifndef NDEBUG
   friend void testInsertion();
   friend void testRandomRemoval(std::size_t);
 #endif
 
 private:
-  using wNode = RBTreeNodePointer<T>;
-  using sNode = std::shared_ptr<const RBTreeNode<value_type>>;
+  using cNode = const RBTreeNode<value_type, Augment>*;
 
-  template <typename Y>
-  RBTreeIterator(const std::shared_ptr<Y> &ptr) noexcept : _ptr(ptr) {}
-  template <typename Y>
-  RBTreeIterator(const RBTreeNodePointer<Y> &ptr) noexcept : _ptr(ptr) {}
+  constexpr RBTreeIterator(cNode ptr) noexcept : _ptr(ptr) {}
 
-  sNode lock() const noexcept {return _ptr.lock();}
+  // the node is owned by the tree, the iterator only borrows it
+  constexpr cNode node() const noexcept {return _ptr;}
 
 public:
   constexpr RBTreeIterator() noexcept {}
 
-  reference operator*() const noexcept {return lock()->value();}
-  pointer operator->() const noexcept {return &lock()->value();}
+  reference operator*() const noexcept {return _ptr->value();}
+  pointer operator->() const noexcept {return &_ptr->value();}
 
-  RBTreeIterator &operator++() {_ptr = lock()->next(); return *this;}
-  RBTreeIterator &operator--() {_ptr = lock()->prev(); return *this;}
-  RBTreeIterator operator++(int) {
+  // one load of the prev/next thread, no tree walk
+  RBTreeIterator &operator++() noexcept {_ptr = _ptr->next(); return *this;}
+  RBTreeIterator &operator--() noexcept {_ptr = _ptr->prev(); return *this;}
+  RBTreeIterator operator++(int) noexcept {
     RBTreeIterator other(*this); ++*this; return other;}
-  RBTreeIterator operator--(int) {
+  RBTreeIterator operator--(int) noexcept {
     RBTreeIterator other(*this); --*this; return other;}
 
   void swap(RBTreeIterator &other) noexcept {
@@ -67,25 +67,25 @@ public:
   }
 
 private:
-  wNode _ptr;
+  cNode _ptr = nullptr;
 };
 
-template <typename T, typename U>
-bool operator==(const RBTreeIterator<T> &lhs, 
-                const RBTreeIterator<U> &rhs) noexcept
+template <typename T, typename U, typename A>
+bool operator==(const RBTreeIterator<T, A> &lhs, 
+                const RBTreeIterator<U, A> &rhs) noexcept
 {
-  return lhs.lock() == rhs.lock();
+  return lhs._ptr == rhs._ptr;
 }
 
-template <typename T, typename U>
-bool operator!=(const RBTreeIterator<T> &lhs, 
-                const RBTreeIterator<U> &rhs) noexcept
+template <typename T, typename U, typename A>
+bool operator!=(const RBTreeIterator<T, A> &lhs, 
+                const RBTreeIterator<U, A> &rhs) noexcept
 {
   return !(lhs == rhs);
 }
 
-template <typename T>
-void swap(RBTreeIterator<T> &lhs, RBTreeIterator<T> &rhs) noexcept
+template <typename T, typename A>
+void swap(RBTreeIterator<T, A> &lhs, RBTreeIterator<T, A> &rhs) noexcept
 {
   lhs.swap(rhs);
 }
@@ -1,20 +1,26 @@
 #ifndef __RBTREE_NODE_HPP_INCLUDED
 #define __RBTREE_NODE_HPP_INCLUDED
 
-#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
 #include <utility>
-template <typename>
+template <typename, typename>
 class RBTreeNode;
-#include <RBTreeNodePointer.hpp>
-
-template <typename T>
-class RBTreeNode :
-public std::enable_shared_from_this<RBTreeNode<T>> {
-  using pNode = std::shared_ptr<RBTreeNode<T>>;
-  using cNode = std::shared_ptr<const RBTreeNode<T>>;
-  using wNode = RBTreeNodePointer<T>;
-  using cwNode = RBTreeNodePointer<const T>;
-  enum color_t {RED, BLACK};
+#include <RBTreeAugment.hpp>
+
+// intrusive node: all links are plain pointers, ownership belongs to the tree;
+// the subtree aggregate of Augment is stored in the base
+//
+// The subtree size is 32 bits and the color one byte, which share a word:
+// an int node is 56 bytes rather than 64, and a tree holds fewer than
+// 2^32 nodes.
+template <typename T, typename Augment = RBTreeNoAugment>
+class RBTreeNode 
+: public RBTreeAggregateHolder<typename Augment::aggregate_type> {
+  using pNode = RBTreeNode*;
+  using cNode = const RBTreeNode*;
+  enum color_t : unsigned char {RED, BLACK};
 
 public:
 ///////////////////////////////////////////////////////////////////////////////
@@ -22,16 +28,23 @@ public:
   using value_type = T;
   using reference = value_type&;
   using const_reference = const value_type&;
+  using size_type = std::size_t;
+  using aggregate_type = typename Augment::aggregate_type;
+  struct in_place_t {};
 
 ///////////////////////////////////////////////////////////////////////////////
 // ctor/dtor
   RBTreeNode() : _value() {}
   RBTreeNode(const value_type &value) : _value(value) {}
-  template <typename std::enable_if<
-    std::is_nothrow_move_constructible<value_type>::value>::type* = nullptr>
-  RBTreeNode(value_type &&value) noexcept : _value(std::move(value)) {}
+  RBTreeNode(value_type &&value) 
+    noexcept(std::is_nothrow_move_constructible<value_type>::value)
+    : _value(std::move(value)) {}
+  // construct the value from args
+  template <typename... Args>
+  RBTreeNode(in_place_t, Args && ... args) 
+    : _value(std::forward<Args>(args)...) {}
   RBTreeNode(const RBTreeNode &other) = delete;
-  ~RBTreeNode() noexcept {}
+  ~RBTreeNode() = default;
 
 ///////////////////////////////////////////////////////////////////////////////
 // query/modifier
@@ -51,6 +64,10 @@ public:
   bool is_red() const noexcept {return _color == RED;}
   bool is_black() const noexcept {return _color == BLACK;}
 
+  // number of nodes in the subtree rooted here
+  std::uint32_t &size() noexcept {return _size;}
+  size_type size() const noexcept {return _size;}
+
   bool leaf_child_count() const noexcept {return !_left + !_right;}
   bool is_root() const noexcept {return !_parent;}
   bool is_end() const noexcept {return !_next;}
@@ -62,46 +79,43 @@ public:
   pNode &right() noexcept {return _right;}
   cNode right() const noexcept {return _right;}
 
-  wNode &parent() noexcept {return _parent;}
-  cwNode parent() const noexcept {return _parent;}
+  pNode &parent() noexcept {return _parent;}
+  cNode parent() const noexcept {return _parent;}
   // must not be root
-  pNode &sibling() 
-    // pNode::get()?
-  {return parent()->left() == this->shared_from_this() ? 
-    parent()->right() : parent()->left();}
-  cNode sibling() const
-  {return parent()->left() == this->shared_from_this() ? 
-    parent()->right() : parent()->left();}
-  pNode &pointer_to_this()
-  {return parent()->left() == this->shared_from_this() ? 
-    parent()->left() : parent()->right();}
-  
+  pNode &sibling() noexcept
+  {return parent()->left() == this ? parent()->right() : parent()->left();}
+  cNode sibling() const noexcept
+  {return parent()->left() == this ? parent()->right() : parent()->left();}
+  pNode &pointer_to_this() noexcept
+  {return parent()->left() == this ? parent()->left() : parent()->right();}
+
   // parent must not be root
-  pNode &uncle() {return parent()->sibling();}
-  cNode uncle() const {return parent()->sibling();}
-  wNode &grandparent() {return parent()->parent();}
-  cwNode grandparent() const {return parent()->parent();}
+  pNode &uncle() noexcept {return parent()->sibling();}
+  cNode uncle() const noexcept {return parent()->sibling();}
+  pNode &grandparent() noexcept {return parent()->parent();}
+  cNode grandparent() const noexcept {return parent()->parent();}
 
-  wNode &prev() noexcept {return _prev;}
-  cwNode prev() const noexcept {return _prev;}
-  wNode &next() noexcept {return _next;}
-  cwNode next() const noexcept {return _next;}
+  pNode &prev() noexcept {return _prev;}
+  cNode prev() const noexcept {return _prev;}
+  pNode &next() noexcept {return _next;}
+  cNode next() const noexcept {return _next;}
 
 private:
   value_type _value;
 
-  pNode _left;
-  pNode _right;
+  pNode _left = nullptr;
+  pNode _right = nullptr;
 
-  wNode _parent;
-  wNode _prev;
-  wNode _next;
+  pNode _parent = nullptr;
+  pNode _prev = nullptr;
+  pNode _next = nullptr;
 
+  std::uint32_t _size = 1;
   color_t _color = RED;
 };
 
 // non swappable
-template <typename T>
-void swap(RBTreeNode<T> &lhs, RBTreeNode<T> &rhs);
+template <typename T, typename Augment>
+void swap(RBTreeNode<T, Augment> &lhs, RBTreeNode<T, Augment> &rhs);
 
 #endif // __RBTREE_NODE_HPP_INCLUDED
@@ -1,7 +1,7 @@
 #ifndef __RBTREE_NODE_DECLARE_HPP_INCLUDED
 #define __RBTREE_NODE_DECLARE_HPP_INCLUDED
 
-template <typename>
+template <typename, typename>
 class RBTreeNode;
 
 #endif // __RBTREE_NODE_DECLARE_HPP_INCLUDED
@@ -0,0 +1,92 @@
+#ifndef __RBTREE_NODE_HANDLE_HPP_INCLUDED
+#define __RBTREE_NODE_HANDLE_HPP_INCLUDED
+
+#include <memory>
+#include <utility>
+template <typename, typename, typename>
+class RBTreeNodeHandle;
+#include <RBTreeAugment.hpp>
+#include <RBTreeDeclare.hpp>
+#include <RBTreeNode.hpp>
+
+// owns a node extracted from an RBTree until it is inserted into a tree
+// with an equal allocator, or destroyed with the handle
+template <typename T, typename Allocator, 
+          typename Augment = RBTreeNoAugment>
+class RBTreeNodeHandle {
+  using Node = RBTreeNode<T, Augment>;
+  using node_allocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<Node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+
+  template <typename T1, typename T2, typename T3, typename T4, 
+            typename T5>
+  friend class RBTree;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using allocator_type = Allocator;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  RBTreeNodeHandle() = default;
+  RBTreeNodeHandle(RBTreeNodeHandle &&other) noexcept
+    : _node(other._node), _alloc(other._alloc) {other._node = nullptr;}
+  RBTreeNodeHandle(const RBTreeNodeHandle &) = delete;
+  ~RBTreeNodeHandle() noexcept {reset();}
+
+///////////////////////////////////////////////////////////////////////////////
+// operator=
+  RBTreeNodeHandle &operator=(RBTreeNodeHandle &&other) noexcept {
+    RBTreeNodeHandle tmp(std::move(other));
+    this->swap(tmp);
+    return *this;
+  }
+  RBTreeNodeHandle &operator=(const RBTreeNodeHandle &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// query/modifier
+  bool empty() const noexcept {return !_node;}
+  explicit operator bool() const noexcept {return _node;}
+
+  // the key may be changed before the node is inserted again
+  value_type &value() const noexcept {return _node->value();}
+  allocator_type get_allocator() const {return allocator_type(_alloc);}
+
+  void swap(RBTreeNodeHandle &other) noexcept {
+    using std::swap;
+    swap(_node, other._node);
+    swap(_alloc, other._alloc);
+  }
+
+private:
+  RBTreeNodeHandle(Node *node, const node_allocator &alloc) noexcept
+    : _node(node), _alloc(alloc) {}
+
+  Node *release() noexcept {
+    Node *node = _node;
+    _node = nullptr;
+    return node;
+  }
+
+  void reset() noexcept {
+    if (!_node) return;
+    node_traits::destroy(_alloc, _node);
+    node_traits::deallocate(_alloc, _node, 1);
+    _node = nullptr;
+  }
+
+  Node *_node = nullptr;
+  node_allocator _alloc;
+};
+
+template <typename T, typename Allocator, typename Augment>
+void swap(RBTreeNodeHandle<T, Allocator, Augment> &lhs,
+          RBTreeNodeHandle<T, Allocator, Augment> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_NODE_HANDLE_HPP_INCLUDED
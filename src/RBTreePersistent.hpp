@@ -0,0 +1,448 @@
+#ifndef __RBTREE_PERSISTENT_HPP_INCLUDED
+#define __RBTREE_PERSISTENT_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+template <typename, typename, typename>
+class RBTreePersistent;
+#include <RBTreePersistentIterator.hpp>
+#include <RBTreePersistentNode.hpp>
+
+// red-black tree with O(1) snapshots
+//
+// Copies (and snapshot()) share all their nodes. A node carries a count of
+// the links to it and is changed in place only while that count is one;
+// a write copies the shared nodes on its path first, so it costs O(log n)
+// node copies at most, and every version stays searchable and iterable on
+// its own. Erase always copies its path, to keep the old root to go back
+// to if a copy throws. Nodes cannot know their parent or neighbours in a
+// shared world, so there are no prev/next threads: iterators hold their
+// path.
+//
+// The balancing is the left-leaning variant, whose recursive fix-ups need
+// no parent links. Versions may be read and destroyed on other threads
+// while one thread writes the live tree, provided the allocator is thread
+// safe; a version is not safe to write from two threads.
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class RBTreePersistent {
+  static_assert(std::is_assignable<T&, const T&>::value
+      && !std::is_reference<T>::value,
+      "RBTreePersistent needs an assignable value type");
+
+  using Node = RBTreePersistentNode<T>;
+  using pNode = Node*;
+  using cNode = const Node*;
+  using node_allocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<Node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+  static_assert(std::is_same<typename node_traits::pointer, pNode>::value,
+      "fancy allocator pointers are not supported");
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using iterator = RBTreePersistentIterator<const T>;
+  using const_iterator = RBTreePersistentIterator<const T>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using size_type = std::size_t;
+  using difference_type = typename iterator::difference_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  explicit RBTreePersistent(const Compare& comp = Compare(),
+                            const Allocator& alloc = Allocator())
+    : _comp(comp), _alloc(alloc) {}
+  template <class InputIt>
+  RBTreePersistent(InputIt first, InputIt last,
+                   const Compare& comp = Compare(),
+                   const Allocator& alloc = Allocator())
+    : RBTreePersistent(comp, alloc) {
+    for (; first != last; ++first) insert(*first);
+  }
+  // O(1), shares every node; the allocator is copied as is, since either
+  // version may be the one to free a shared node
+  RBTreePersistent(const RBTreePersistent &other) noexcept
+    : _root(other._root), _size(other._size), _comp(other._comp),
+      _alloc(other._alloc) {
+    if (_root) _root->retain();
+  }
+  RBTreePersistent(RBTreePersistent &&other) noexcept
+    : _comp(other._comp), _alloc(other._alloc) {this->swap(other);}
+
+///////////////////////////////////////////////////////////////////////////////
+// dtor
+  ~RBTreePersistent() noexcept {clear();}
+
+///////////////////////////////////////////////////////////////////////////////
+// operator=
+  RBTreePersistent &operator=(const RBTreePersistent &other) noexcept {
+    RBTreePersistent cpy(other);
+    this->swap(cpy);
+    return *this;
+  }
+  RBTreePersistent &operator=(RBTreePersistent &&other) noexcept {
+    this->swap(other); return *this;}
+
+///////////////////////////////////////////////////////////////////////////////
+// snapshot
+  // O(1) copy of the current contents; later writes to either side do
+  // not show in the other
+  RBTreePersistent snapshot() const noexcept {return *this;}
+
+///////////////////////////////////////////////////////////////////////////////
+// allocator
+  allocator_type get_allocator() const {return allocator_type(_alloc);}
+
+///////////////////////////////////////////////////////////////////////////////
+// iterators
+  const_iterator begin() const {
+    const_iterator it(_root);
+    it.push_leftmost(_root);
+    return it;
+  }
+  const_iterator cbegin() const {return begin();}
+  const_iterator end() const {return const_iterator(_root);}
+  const_iterator cend() const {return end();}
+  const_reverse_iterator rbegin() const
+  {return std::make_reverse_iterator(end());}
+  const_reverse_iterator rend() const
+  {return std::make_reverse_iterator(begin());}
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return !_root;}
+  size_type size() const noexcept {return _size;}
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void clear() noexcept {
+    release(_root);
+    _root = nullptr;
+    _size = 0;
+  }
+
+  // if copying a shared node or the value throws, *this is unchanged
+  std::pair<iterator, bool> insert(const_reference value) {
+    if (contains(value)) return {find(value), false};
+    pNode node = create_node(value);
+    try {
+      // the fix-ups touch only the path and its children, own them first
+      for (pNode *link = &_root; *link; ) {
+        own(*link);
+        own_children(*link);
+        link = _comp(value, (*link)->value()) ? &(*link)->left()
+                                               : &(*link)->right();
+      }
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    put(_root, node);
+    _root->set_black();
+    ++_size;
+    return {find(value), true};
+  }
+
+  // if copying a shared node or a value throws, *this is unchanged: the
+  // old root stays shared meanwhile, so the erase copies its path instead
+  // of changing it, and it is put back
+  size_type erase(const_reference value) {
+    if (!contains(value)) return 0;
+    pNode old = _root;
+    old->retain();
+    try {
+      if (!is_red(_root->left()) && !is_red(_root->right())) {
+        own(_root);
+        _root->set_red();
+      }
+      erase(_root, value);
+      if (_root) {
+        own(_root);
+        _root->set_black();
+      }
+    } catch (...) {
+      release(_root);
+      _root = old;
+      throw;
+    }
+    release(old);
+    --_size;
+    return 1;
+  }
+
+  void swap(RBTreePersistent &other) noexcept {
+    using std::swap;
+    swap(_root, other._root);
+    swap(_size, other._size);
+    swap(_comp, other._comp);
+    swap(_alloc, other._alloc);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  const_iterator find(const_reference value) const {
+    const_iterator it = lower_bound(value);
+    if (it != end() && _comp(value, *it)) return end();
+    return it;
+  }
+
+  size_type count(const_reference value) const {return contains(value);}
+
+  bool contains(const_reference value) const {
+    for (cNode n = _root; n; ) {
+      if (_comp(n->value(), value)) n = n->right();
+      else if (_comp(value, n->value())) n = n->left();
+      else return true;
+    }
+    return false;
+  }
+
+  // the path is cut back to the last node where the search went left
+  const_iterator lower_bound(const_reference value) const {
+    const_iterator it(_root);
+    size_type keep = 0;
+    for (cNode n = _root; n; ) {
+      it._path.push_back(n);
+      if (_comp(n->value(), value)) n = n->right();
+      else {
+        keep = it._path.size();
+        n = n->left();
+      }
+    }
+    it._path.resize(keep);
+    return it;
+  }
+
+  const_iterator upper_bound(const_reference value) const {
+    const_iterator it(_root);
+    size_type keep = 0;
+    for (cNode n = _root; n; ) {
+      it._path.push_back(n);
+      if (!_comp(value, n->value())) n = n->right();
+      else {
+        keep = it._path.size();
+        n = n->left();
+      }
+    }
+    it._path.resize(keep);
+    return it;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// observers
+  value_compare value_comp() const {return _comp;}
+
+#ifndef NDEBUG
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  bool is_valid_rb_tree() const {
+    return !is_red(_root) && check(_root, nullptr, nullptr).second;
+  }
+#endif  //NDEBUG
+
+private:
+  pNode _root = nullptr;
+  size_type _size = 0;
+  Compare _comp;
+  node_allocator _alloc;
+
+///////////////////////////////////////////////////////////////////////////////
+// node allocation
+  template <typename... Args>
+  pNode create_node(Args && ... args) {
+    pNode p = node_traits::allocate(_alloc, 1);
+    try {
+      node_traits::construct(_alloc, p, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(_alloc, p, 1);
+      throw;
+    }
+    return p;
+  }
+
+  void destroy_node(pNode p) noexcept {
+    node_traits::destroy(_alloc, p);
+    node_traits::deallocate(_alloc, p, 1);
+  }
+
+  // drop one link to n, freeing what nobody links to any more
+  void release(pNode n) noexcept {
+    if (!n || !n->release()) return;
+    release(n->left());
+    release(n->right());
+    destroy_node(n);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// copy on write
+  // make *link a node only this version links to
+  void own(pNode &link) {
+    if (!link->is_shared()) return;
+    pNode copy = create_node(link->value());
+    copy->set_color_of(link);
+    copy->left() = link->left();
+    copy->right() = link->right();
+    if (copy->left()) copy->left()->retain();
+    if (copy->right()) copy->right()->retain();
+    pNode old = link;
+    link = copy;
+    release(old);
+  }
+
+  void own_children(pNode n) {
+    if (n->left()) own(n->left());
+    if (n->right()) own(n->right());
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// balancing
+  static bool is_red(cNode n) noexcept {return n && n->is_red();}
+
+  void rotate_left(pNode &h) {
+    own(h);
+    own(h->right());
+    pNode x = h->right();
+    h->right() = x->left();
+    x->left() = h;
+    x->set_color_of(h);
+    h->set_red();
+    h = x;
+  }
+
+  void rotate_right(pNode &h) {
+    own(h);
+    own(h->left());
+    pNode x = h->left();
+    h->left() = x->right();
+    x->right() = h;
+    x->set_color_of(h);
+    h->set_red();
+    h = x;
+  }
+
+  void flip_colors(pNode &h) {
+    own(h);
+    own_children(h);
+    h->flip_color();
+    h->left()->flip_color();
+    h->right()->flip_color();
+  }
+
+  // restore the left-leaning shape on the way up
+  void fix_up(pNode &h) {
+    if (is_red(h->right()) && !is_red(h->left())) rotate_left(h);
+    if (is_red(h->left()) && is_red(h->left()->left())) rotate_right(h);
+    if (is_red(h->left()) && is_red(h->right())) flip_colors(h);
+  }
+
+  // borrow a red from the right so that h->left is not a lone black
+  void move_red_left(pNode &h) {
+    flip_colors(h);
+    if (is_red(h->right()->left())) {
+      rotate_right(h->right());
+      rotate_left(h);
+      flip_colors(h);
+    }
+  }
+
+  void move_red_right(pNode &h) {
+    flip_colors(h);
+    if (is_red(h->left()->left())) {
+      rotate_right(h);
+      flip_colors(h);
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// insertion/removal
+  // the path down to node's place is owned already, nothing here throws
+  void put(pNode &h, pNode node) {
+    if (!h) {
+      h = node;
+      return;
+    }
+    if (_comp(node->value(), h->value())) put(h->left(), node);
+    else put(h->right(), node);
+    fix_up(h);
+  }
+
+  void drop(pNode &h) noexcept {
+    pNode n = h;
+    h = nullptr;
+    release(n);
+  }
+
+  void erase_min(pNode &h) {
+    if (!h->left()) {
+      drop(h);
+      return;
+    }
+    if (!is_red(h->left()) && !is_red(h->left()->left())) move_red_left(h);
+    own(h);
+    erase_min(h->left());
+    fix_up(h);
+  }
+
+  // value is in the subtree of h
+  void erase(pNode &h, const_reference value) {
+    if (_comp(value, h->value())) {
+      if (!is_red(h->left()) && !is_red(h->left()->left()))
+        move_red_left(h);
+      own(h);
+      erase(h->left(), value);
+    } else {
+      if (is_red(h->left())) rotate_right(h);
+      if (!_comp(h->value(), value) && !h->right()) {
+        drop(h);
+        return;
+      }
+      if (!is_red(h->right()) && !is_red(h->right()->left()))
+        move_red_right(h);
+      own(h);
+      if (!_comp(h->value(), value)) {
+        cNode min = h->right();
+        while (min->left()) min = min->left();
+        h->value() = min->value();
+        erase_min(h->right());
+      } else erase(h->right(), value);
+    }
+    fix_up(h);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// DEBUG
+  // black height, and whether the subtree is ordered within (lo, hi) and
+  // left-leaning with no red pair
+  std::pair<size_type, bool> check(cNode n, cNode lo, cNode hi) const {
+    if (!n) return {1, true};
+    if ((lo && !_comp(lo->value(), n->value())) ||
+        (hi && !_comp(n->value(), hi->value())))
+      return {0, false};
+    if (is_red(n->right()) || (is_red(n) && is_red(n->left())))
+      return {0, false};
+    auto l = check(n->left(), lo, n);
+    auto r = check(n->right(), n, hi);
+    if (!l.second || !r.second || l.first != r.first) return {0, false};
+    return {l.first + n->is_black(), true};
+  }
+};
+
+template <typename T, typename Compare, typename Allocator>
+void swap(RBTreePersistent<T, Compare, Allocator> &lhs,
+          RBTreePersistent<T, Compare, Allocator> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_PERSISTENT_HPP_INCLUDED
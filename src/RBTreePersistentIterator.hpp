@@ -0,0 +1,129 @@
+#ifndef __RBTREE_PERSISTENT_ITERATOR_HPP_INCLUDED
+#define __RBTREE_PERSISTENT_ITERATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+template <typename, typename>
+class RBTreePersistentIterator;
+#include <RBTreePersistentNode.hpp>
+
+template <typename, typename, typename>
+class RBTreePersistent;
+
+template <typename T, typename Enable = void>
+class RBTreePersistentIterator;
+
+// nodes are shared between versions and have no parent links, so the
+// iterator carries the path from the root down to its node; end() is the
+// empty path. Valid while the version it came from is alive and unchanged.
+template <typename T>
+class RBTreePersistentIterator<T,
+      typename std::enable_if<std::is_const<T>::value>::type> {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// iterator traits
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename std::remove_const<T>::type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
+
+///////////////////////////////////////////////////////////////////////////////
+// friends
+  template <typename T1, typename T2, typename T3>
+  friend class RBTreePersistent;
+  template <typename T1, typename T2>
+  friend bool operator==(const RBTreePersistentIterator<T1> &,
+                         const RBTreePersistentIterator<T2> &) noexcept;
+
+private:
+  using cNode = const RBTreePersistentNode<value_type>*;
+
+  explicit RBTreePersistentIterator(cNode root) : _root(root) {}
+
+  cNode node() const noexcept {return _path.empty() ? nullptr : _path.back();}
+
+  void push_leftmost(cNode n) {
+    for (; n; n = n->left()) _path.push_back(n);
+  }
+  void push_rightmost(cNode n) {
+    for (; n; n = n->right()) _path.push_back(n);
+  }
+
+public:
+  RBTreePersistentIterator() = default;
+
+  reference operator*() const noexcept {return _path.back()->value();}
+  pointer operator->() const noexcept {return &_path.back()->value();}
+
+  RBTreePersistentIterator &operator++() {
+    cNode n = _path.back();
+    if (n->right()) {
+      push_leftmost(n->right());
+      return *this;
+    }
+    _path.pop_back();
+    while (!_path.empty() && _path.back()->right() == n) {
+      n = _path.back();
+      _path.pop_back();
+    }
+    return *this;
+  }
+  RBTreePersistentIterator &operator--() {
+    if (_path.empty()) {
+      push_rightmost(_root);
+      return *this;
+    }
+    cNode n = _path.back();
+    if (n->left()) {
+      push_rightmost(n->left());
+      return *this;
+    }
+    _path.pop_back();
+    while (_path.back()->left() == n) {
+      n = _path.back();
+      _path.pop_back();
+    }
+    return *this;
+  }
+  RBTreePersistentIterator operator++(int) {
+    RBTreePersistentIterator other(*this); ++*this; return other;}
+  RBTreePersistentIterator operator--(int) {
+    RBTreePersistentIterator other(*this); --*this; return other;}
+
+  void swap(RBTreePersistentIterator &other) noexcept {
+    using std::swap;
+    swap(_root, other._root);
+    swap(_path, other._path);
+  }
+
+private:
+  cNode _root = nullptr;
+  std::vector<cNode> _path;
+};
+
+template <typename T, typename U>
+bool operator==(const RBTreePersistentIterator<T> &lhs,
+                const RBTreePersistentIterator<U> &rhs) noexcept
+{
+  return lhs.node() == rhs.node();
+}
+
+template <typename T, typename U>
+bool operator!=(const RBTreePersistentIterator<T> &lhs,
+                const RBTreePersistentIterator<U> &rhs) noexcept
+{
+  return !(lhs == rhs);
+}
+
+template <typename T>
+void swap(RBTreePersistentIterator<T> &lhs,
+          RBTreePersistentIterator<T> &rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+
+#endif // __RBTREE_PERSISTENT_ITERATOR_HPP_INCLUDED
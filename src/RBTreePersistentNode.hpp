@@ -0,0 +1,70 @@
+#ifndef __RBTREE_PERSISTENT_NODE_HPP_INCLUDED
+#define __RBTREE_PERSISTENT_NODE_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+template <typename>
+class RBTreePersistentNode;
+
+// node of RBTreePersistent: shared by every version of the tree that
+// reaches it, so it has no parent or prev/next links, only a count of the
+// links (parents and tree roots) pointing at it
+template <typename T>
+class RBTreePersistentNode {
+  using pNode = RBTreePersistentNode*;
+  using cNode = const RBTreePersistentNode*;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using size_type = std::size_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  template <typename... Args>
+  explicit RBTreePersistentNode(Args && ... args)
+    : _value(std::forward<Args>(args)...) {}
+  RBTreePersistentNode(const RBTreePersistentNode &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// query/modifier
+  reference value() noexcept {return _value;}
+  const_reference value() const noexcept {return _value;}
+
+  void set_red() noexcept {_red = true;}
+  void set_black() noexcept {_red = false;}
+  void flip_color() noexcept {_red = !_red;}
+  void set_color_of(cNode other) noexcept {_red = other->_red;}
+  bool is_red() const noexcept {return _red;}
+  bool is_black() const noexcept {return !_red;}
+
+  // only a node nobody else links to may be changed in place
+  bool is_shared() const noexcept
+  {return _refs.load(std::memory_order_acquire) != 1;}
+  void retain() noexcept {_refs.fetch_add(1, std::memory_order_relaxed);}
+  // true if that was the last link
+  bool release() noexcept
+  {return _refs.fetch_sub(1, std::memory_order_acq_rel) == 1;}
+
+///////////////////////////////////////////////////////////////////////////////
+// node operations
+  pNode &left() noexcept {return _left;}
+  cNode left() const noexcept {return _left;}
+  pNode &right() noexcept {return _right;}
+  cNode right() const noexcept {return _right;}
+
+private:
+  value_type _value;
+
+  pNode _left = nullptr;
+  pNode _right = nullptr;
+
+  std::atomic<size_type> _refs {1};
+  bool _red = true;
+};
+
+#endif // __RBTREE_PERSISTENT_NODE_HPP_INCLUDED
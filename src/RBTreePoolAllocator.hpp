@@ -0,0 +1,226 @@
+#ifndef __RBTREE_POOL_ALLOCATOR_HPP_INCLUDED
+#define __RBTREE_POOL_ALLOCATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+template <typename, std::size_t>
+class RBTreePoolAllocator;
+template <std::size_t>
+class RBTreePoolArena;
+
+// the blocks behind RBTreePoolAllocator: one pool of blocks for each block
+// size, shared by every copy and rebinding of an allocator
+template <std::size_t ChunkSize>
+class RBTreePoolArena {
+public:
+  class Pool {
+  public:
+    explicit Pool(std::size_t block) : _block(block) {}
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    std::size_t block_size() const noexcept {return _block;}
+
+    // a reservation is served from its chunk in order, ahead of the free
+    // list
+    void *allocate() {
+      if (_reserved) {
+        --_reserved;
+        return carve();
+      }
+      if (_free) {
+        void *b = _free;
+        _free = *static_cast<void**>(b);
+        return b;
+      }
+      return carve();
+    }
+
+    void deallocate(void *p) noexcept {
+      *static_cast<void**>(p) = _free;
+      _free = p;
+    }
+
+    // drop every chunk at once, O(chunks)
+    void release() noexcept {
+      _chunks.clear();
+      _free = nullptr;
+      _cursor = _limit = _spare = _spare_limit = nullptr;
+      _reserved = 0;
+    }
+
+    // the next n blocks are handed out one after another from one
+    // contiguous chunk
+    void reserve(std::size_t n) {
+      if (static_cast<std::size_t>(_limit - _cursor) / _block < n) {
+        // the tail of the current chunk is used once the new one runs out;
+        // an older tail still unused goes to the free list
+        for (; _spare != _spare_limit; _spare += _block) deallocate(_spare);
+        _spare = _cursor;
+        _spare_limit = _limit;
+        grow(n < ChunkSize ? ChunkSize : n);
+      }
+      _reserved = n;
+    }
+
+    std::size_t chunk_count() const noexcept {return _chunks.size();}
+
+  private:
+    // the next block of the current chunk, then of the spare tail, then
+    // of a new chunk
+    void *carve() {
+      if (_cursor == _limit) {
+        if (_spare != _spare_limit) {
+          _cursor = _spare;
+          _limit = _spare_limit;
+          _spare = _spare_limit = nullptr;
+        } else grow(ChunkSize);
+      }
+      void *b = _cursor;
+      _cursor += _block;
+      return b;
+    }
+
+    // new char[] is aligned for any fundamental type, and _block is a
+    // multiple of the alignment of the types it serves
+    void grow(std::size_t n) {
+      _chunks.emplace_back(new char[n * _block]);
+      _cursor = _chunks.back().get();
+      _limit = _cursor + n * _block;
+    }
+
+    std::size_t _block;
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    void *_free = nullptr;
+    char *_cursor = nullptr;
+    char *_limit = nullptr;
+    char *_spare = nullptr; // the tail left when reserve() grew
+    char *_spare_limit = nullptr;
+    std::size_t _reserved = 0;
+  };
+
+  Pool &pool(std::size_t block) {
+    for (auto &p : _pools)
+      if (p->block_size() == block) return *p;
+    _pools.emplace_back(new Pool(block));
+    return *_pools.back();
+  }
+  const Pool *find(std::size_t block) const noexcept {
+    for (auto &p : _pools)
+      if (p->block_size() == block) return p.get();
+    return nullptr;
+  }
+  // every pool drops every chunk
+  void release() noexcept {for (auto &p : _pools) p->release();}
+
+private:
+  std::vector<std::unique_ptr<Pool>> _pools;
+};
+
+// slab allocator for tree nodes
+//
+// single-object requests are carved out of chunks of ChunkSize blocks and
+// recycled through an intrusive free list; any other request goes straight
+// to operator new. Copies share one arena, rebound copies included, so a
+// tree's node allocator compares equal to the allocator it was given; the
+// arena keeps a pool of blocks for each block size. Not thread safe.
+template <typename T, std::size_t ChunkSize = 4096>
+class RBTreePoolAllocator {
+  static_assert(ChunkSize > 0, "ChunkSize must be positive");
+
+  template <typename, std::size_t>
+  friend class RBTreePoolAllocator;
+
+  static constexpr std::size_t round_up(std::size_t n, std::size_t a) {
+    return (n + a - 1) / a * a;
+  }
+  // room for a T or a free list link, aligned for either
+  static constexpr std::size_t block_size = round_up(
+      sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*),
+      alignof(T) > alignof(void*) ? alignof(T) : alignof(void*));
+
+  using Arena = RBTreePoolArena<ChunkSize>;
+  using Pool = typename Arena::Pool;
+
+  // looked up on first use, rebinding must not throw; a block being
+  // freed means its pool exists already, so freeing does not throw either
+  Pool &pool() {
+    if (!_pool) _pool = &_arena->pool(block_size);
+    return *_pool;
+  }
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using value_type = T;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U>
+  struct rebind {using other = RBTreePoolAllocator<U, ChunkSize>;};
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  RBTreePoolAllocator() : _arena(std::make_shared<Arena>()) {}
+  RBTreePoolAllocator(const RBTreePoolAllocator &other) noexcept = default;
+  template <typename U>
+  RBTreePoolAllocator(const RBTreePoolAllocator<U, ChunkSize> &other)
+    noexcept : _arena(other._arena) {}
+
+  // a copied container gets its own arena
+  RBTreePoolAllocator select_on_container_copy_construction() const {
+    return RBTreePoolAllocator();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// allocation
+  T *allocate(size_type n) {
+    if (n == 1) return static_cast<T*>(pool().allocate());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_type n) noexcept {
+    if (n == 1) pool().deallocate(p);
+    else ::operator delete(p);
+  }
+
+  // frees all blocks handed out by the arena, of every block size, live or
+  // not; objects in them must already be destroyed or trivially
+  // destructible
+  void release() noexcept {_arena->release();}
+  void reserve(size_type n) {pool().reserve(n);}
+  // chunks of T-sized blocks
+  size_type chunk_count() const noexcept {
+    const Pool *p = _arena->find(block_size);
+    return p ? p->chunk_count() : 0;
+  }
+  // no other copy or rebinding shares the arena
+  bool exclusive() const noexcept {return _arena.use_count() == 1;}
+
+  template <typename U, std::size_t N>
+  bool operator==(const RBTreePoolAllocator<U, N> &other) const noexcept {
+    return static_cast<const void*>(_arena.get()) ==
+           static_cast<const void*>(other._arena.get());
+  }
+  template <typename U, std::size_t N>
+  bool operator!=(const RBTreePoolAllocator<U, N> &other) const noexcept {
+    return !(*this == other);
+  }
+
+private:
+  std::shared_ptr<Arena> _arena;
+  Pool *_pool = nullptr;
+};
+
+template <typename T, std::size_t ChunkSize>
+constexpr std::size_t RBTreePoolAllocator<T, ChunkSize>::block_size;
+
+#endif // __RBTREE_POOL_ALLOCATOR_HPP_INCLUDED
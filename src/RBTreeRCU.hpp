@@ -0,0 +1,165 @@
+#ifndef __RBTREE_RCU_HPP_INCLUDED
+#define __RBTREE_RCU_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+template <typename, typename, typename>
+class RBTreeRCU;
+#include <RBTreeEpoch.hpp>
+#include <RBTreePersistent.hpp>
+
+// read-copy-update ordered set: readers never lock, never wait
+//
+// Writers change a private RBTreePersistent and publish an O(1) snapshot
+// of it through one atomic pointer; published versions are immutable, so
+// a reader loads the pointer and walks plain nodes without touching any
+// count. Superseded versions are retired and destroyed by a later write
+// once RBTreeEpoch shows no reader can still hold them, which frees only
+// the nodes no newer version shares. Writers are serialized by a mutex
+// and never block readers; readers never delay a write, only the freeing
+// of what it retired.
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class RBTreeRCU {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using tree_type = RBTreePersistent<T, Compare, Allocator>;
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using size_type = typename tree_type::size_type;
+
+  // pins the version current at construction; use it like a
+  // const tree_type *, iterators included, while it lives
+  class reader {
+  public:
+    reader(reader &&other) noexcept
+      : _rcu(other._rcu), _parity(other._parity), _version(other._version)
+    {other._rcu = nullptr;}
+    reader(const reader &) = delete;
+    reader &operator=(const reader &) = delete;
+    ~reader() noexcept {if (_rcu) _rcu->_epoch.exit(_parity);}
+
+    const tree_type &operator*() const noexcept {return *_version;}
+    const tree_type *operator->() const noexcept {return _version;}
+
+  private:
+    friend class RBTreeRCU;
+    explicit reader(const RBTreeRCU &rcu) noexcept
+      : _rcu(&rcu), _parity(rcu._epoch.enter()),
+        _version(rcu._published.load()) {}
+
+    const RBTreeRCU *_rcu;
+    std::size_t _parity;
+    const tree_type *_version;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  explicit RBTreeRCU(const Compare& comp = Compare(),
+                     const Allocator& alloc = Allocator())
+    : RBTreeRCU(tree_type(comp, alloc)) {}
+  explicit RBTreeRCU(tree_type tree)
+    : _live(std::move(tree)), _published(new tree_type(_live)) {}
+  RBTreeRCU(const RBTreeRCU &) = delete;
+  RBTreeRCU &operator=(const RBTreeRCU &) = delete;
+
+  // no reader may be alive
+  ~RBTreeRCU() noexcept {delete _published.load();}
+
+///////////////////////////////////////////////////////////////////////////////
+// readers
+  reader read() const noexcept {return reader(*this);}
+
+  bool empty() const noexcept {return read()->empty();}
+  size_type size() const noexcept {return read()->size();}
+  size_type count(const_reference value) const {return contains(value);}
+  bool contains(const_reference value) const {
+    return read()->contains(value);
+  }
+  // copy the element found into out, if any
+  bool find(const_reference value, reference out) const {
+    auto r = read();
+    auto it = r->find(value);
+    if (it == r->end()) return false;
+    out = *it;
+    return true;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// writers
+  bool insert(const_reference value) {
+    return write([&value](tree_type &t) {return t.insert(value).second;});
+  }
+  size_type erase(const_reference value) {
+    return write([&value](tree_type &t) {return t.erase(value);});
+  }
+  void clear() {write([](tree_type &t) {t.clear();});}
+
+  // f(tree_type &), published as one update when it returns, also when
+  // it throws
+  template <class F>
+  auto write(F &&f) -> decltype(f(std::declval<tree_type&>())) {
+    std::lock_guard<std::mutex> lock(_writer);
+    Publish publish{*this};
+    return f(_live);
+  }
+
+  // wait for every reader that may hold a superseded version, then free
+  // them all
+  void synchronize() {
+    std::lock_guard<std::mutex> lock(_writer);
+    while (!_limbo[0].empty() || !_limbo[1].empty()) {
+      if (!advance()) std::this_thread::yield();
+    }
+  }
+
+private:
+  struct Publish {
+    ~Publish() noexcept {rcu.publish();}
+    RBTreeRCU &rcu;
+  };
+
+  void publish() noexcept {
+    // a failed allocation leaves readers on the previous version until
+    // the next write publishes
+    tree_type *next = new (std::nothrow) tree_type(_live);
+    if (!next) return;
+    const tree_type *old = _published.exchange(next);
+    try {
+      _limbo[_epoch.epoch() & 1].emplace_back(old);
+    } catch (...) {
+      // cannot defer it, so wait it out
+      std::size_t e = _epoch.epoch();
+      while (_epoch.epoch() < e + 2)
+        if (!advance()) std::this_thread::yield();
+      delete old;
+    }
+    advance();
+  }
+
+  // a version retired during e - 1 is freed when moving past e
+  bool advance() noexcept {
+    std::size_t parity = (_epoch.epoch() + 1) & 1;
+    if (!_epoch.try_advance()) return false;
+    _limbo[parity].clear();
+    return true;
+  }
+
+  tree_type _live;
+  std::atomic<const tree_type*> _published;
+  mutable RBTreeEpoch<> _epoch;
+  std::vector<std::unique_ptr<const tree_type>> _limbo[2];
+  std::mutex _writer;
+};
+
+#endif // __RBTREE_RCU_HPP_INCLUDED
@@ -0,0 +1,301 @@
+#ifndef __RBTREE_SHARDED_HPP_INCLUDED
+#define __RBTREE_SHARDED_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+template <typename, typename, typename, typename>
+class RBTreeSharded;
+#include <RBTree.hpp>
+#include <RBTreeStripedLock.hpp>
+
+// ordered set split by key range into RBTree shards with a lock each
+//
+// Shard k holds the values in [bound k - 1, bound k), so writes to
+// different ranges run in parallel. An insert that leaves its shard
+// holding a good deal more than an even share, or that makes the set big
+// enough for more shards, asks for a rebalance, which joins all shards
+// and splits them again at even ranks, O(S log n) for S shards and no
+// copying; it waits for the operations in flight and holds the others
+// off meanwhile. Shards start as one and are only created by splitting,
+// so they share one node allocator, which must be thread safe.
+template <typename T, typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>,
+          typename Augment = RBTreeNoAugment>
+class RBTreeSharded {
+  using Lock = RBTreeStripedLock<>;
+  using ReadLock = std::shared_lock<Lock>;
+  using WriteLock = std::lock_guard<Lock>;
+
+public:
+///////////////////////////////////////////////////////////////////////////////
+// member types
+  using tree_type = RBTree<T, Compare, Allocator, Augment>;
+  using value_type = T;
+  using value_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using size_type = typename tree_type::size_type;
+
+  // shards this small are left alone however skewed
+  static constexpr size_type min_shard_size = 256;
+
+///////////////////////////////////////////////////////////////////////////////
+// ctor
+  explicit RBTreeSharded(
+      size_type shards = std::thread::hardware_concurrency(),
+      const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+    : _max_shards(std::max<size_type>(shards, 1)), _comp(comp) {
+    _shards.emplace_back(new Shard(tree_type(comp, alloc)));
+  }
+  template <class InputIt>
+  RBTreeSharded(InputIt first, InputIt last,
+      size_type shards = std::thread::hardware_concurrency(),
+      const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+    : _max_shards(std::max<size_type>(shards, 1)), _comp(comp) {
+    _shards.emplace_back(new Shard(tree_type(first, last, comp, alloc)));
+    _size = _shards.front()->tree.size();
+    rebalance();
+  }
+  RBTreeSharded(const RBTreeSharded &) = delete;
+  RBTreeSharded &operator=(const RBTreeSharded &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// capacity
+  bool empty() const noexcept {return !size();}
+  size_type size() const noexcept {return _size.load();}
+  size_type shard_count() const {
+    ReadLock layout(_layout);
+    return _shards.size();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// modifiers
+  void clear() {
+    WriteLock layout(_layout);
+    for (auto &s : _shards) s->tree.clear();
+    _size = 0;
+  }
+
+  bool insert(const_reference value) {
+    return insert_with(value, [&value](tree_type &t) {
+      return t.insert(value).second;
+    });
+  }
+  bool insert(value_type &&value) {
+    return insert_with(value, [&value](tree_type &t) {
+      return t.insert(std::move(value)).second;
+    });
+  }
+  // the value is built first, to know its shard
+  template <typename... Args>
+  bool emplace(Args && ... args) {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  size_type erase(const_reference value) {
+    ReadLock layout(_layout);
+    Shard &s = *_shards[route(value)];
+    WriteLock lock(s.lock);
+    size_type erased = s.tree.erase(value);
+    _size -= erased;
+    return erased;
+  }
+
+  // join all shards and split them again at even ranks
+  void rebalance() {
+    WriteLock layout(_layout);
+    redistribute();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// lookup
+  size_type count(const_reference value) const {return contains(value);}
+  bool contains(const_reference value) const {
+    ReadLock layout(_layout);
+    const Shard &s = *_shards[route(value)];
+    ReadLock lock(s.lock);
+    return s.tree.contains(value);
+  }
+
+  // copy the element found into out, if any
+  bool find(const_reference value, reference out) const {
+    ReadLock layout(_layout);
+    const Shard &s = *_shards[route(value)];
+    ReadLock lock(s.lock);
+    auto it = s.tree.find(value);
+    if (it == s.tree.end()) return false;
+    out = *it;
+    return true;
+  }
+
+  // the first shard from value's on with an answer has it
+  bool lower_bound(const_reference value, reference out) const {
+    return bound(value, out, [&value](const tree_type &t) {
+      return t.lower_bound(value);
+    });
+  }
+  bool upper_bound(const_reference value, reference out) const {
+    return bound(value, out, [&value](const tree_type &t) {
+      return t.upper_bound(value);
+    });
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// whole set
+  // f(value) for every value in order, on a consistent view: every shard
+  // is read locked until the end
+  template <class F>
+  void for_each(F &&f) const {
+    ReadLock layout(_layout);
+    std::vector<ReadLock> locks;
+    locks.reserve(_shards.size());
+    for (const auto &s : _shards) locks.emplace_back(s->lock);
+    for (const auto &s : _shards)
+      for (const auto &x : s->tree) f(x);
+  }
+
+  tree_type snapshot() const {
+    std::vector<value_type> values;
+    values.reserve(size());
+    for_each([&values](const_reference x) {values.push_back(x);});
+    return tree_type(sorted_unique, values.begin(), values.end(), _comp,
+                     _shards.front()->tree.get_allocator());
+  }
+
+private:
+  struct Shard {
+    explicit Shard(tree_type &&tree) : tree(std::move(tree)) {}
+    tree_type tree;
+    mutable Lock lock;
+  };
+
+  size_type route(const_reference value) const {
+    return std::upper_bound(_bounds.begin(), _bounds.end(), value, _comp)
+      - _bounds.begin();
+  }
+
+  // how many shards n elements call for
+  size_type target_shards(size_type n) const noexcept {
+    return std::min(_max_shards, std::max<size_type>(n / min_shard_size, 1));
+  }
+
+  // a shard holding half as much again as an even share of the shards
+  // there are now
+  bool skewed(size_type n) const noexcept {
+    return n > min_shard_size && 2 * n * _shards.size() > 3 * size();
+  }
+
+  // more shards are due, or one of them is skewed; with the layout lock
+  bool unbalanced() const noexcept {
+    if (target_shards(size()) > _shards.size()) return true;
+    for (const auto &s : _shards)
+      if (skewed(s->tree.size())) return true;
+    return false;
+  }
+
+  template <class Insert>
+  bool insert_with(const_reference value, Insert insert) {
+    bool inserted, rebalance;
+    {
+      ReadLock layout(_layout);
+      Shard &s = *_shards[route(value)];
+      WriteLock lock(s.lock);
+      inserted = insert(s.tree);
+      _size += inserted;
+      rebalance = inserted && (skewed(s.tree.size())
+          || target_shards(size()) > _shards.size());
+    }
+    // one thread at a time, the others carry on
+    if (rebalance && !_rebalancing.exchange(true)) {
+      try {
+        WriteLock layout(_layout);
+        if (unbalanced()) redistribute();
+      } catch (...) {
+        _rebalancing = false;
+        throw;
+      }
+      _rebalancing = false;
+    }
+    return inserted;
+  }
+
+  template <class Bound>
+  bool bound(const_reference value, reference out, Bound bound) const {
+    ReadLock layout(_layout);
+    for (size_type i = route(value); i != _shards.size(); ++i) {
+      ReadLock lock(_shards[i]->lock);
+      auto it = bound(_shards[i]->tree);
+      if (it != _shards[i]->tree.end()) {
+        out = *it;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // under the exclusive layout lock; if a split throws, everything ends up
+  // in one shard
+  void redistribute() {
+    if (_shards.size() == 1 && target_shards(size()) == 1) return;
+    tree_type all(std::move(_shards.front()->tree));
+    for (size_type i = 1; i != _shards.size(); ++i)
+      all.join(std::move(_shards[i]->tree));
+    _shards.resize(1);
+    _bounds.clear();
+
+    size_type n = all.size();
+    size_type parts = target_shards(n);
+    std::vector<tree_type> pieces;
+    std::vector<value_type> bounds;
+    try {
+      pieces.reserve(parts);
+      bounds.reserve(parts);
+      for (size_type k = parts - 1; k != 0; --k) {
+        bounds.push_back(*all.nth(k * n / parts));
+        pieces.push_back(all.split(bounds.back()));
+      }
+      std::reverse(pieces.begin(), pieces.end());
+      std::reverse(bounds.begin(), bounds.end());
+      _shards.reserve(parts);
+      for (size_type k = 1; k != parts; ++k)
+        _shards.emplace_back(new Shard(tree_type(all.value_comp())));
+    } catch (...) {
+      std::sort(pieces.begin(), pieces.end(),
+          [this](const tree_type &lhs, const tree_type &rhs) {
+            return _comp(*lhs.begin(), *rhs.begin());
+          });
+      for (auto &p : pieces) all.join(std::move(p));
+      _shards.resize(1);
+      _shards.front()->tree.swap(all);
+      throw;
+    }
+    // nothing below throws
+    _shards.front()->tree.swap(all);
+    for (size_type k = 1; k != parts; ++k)
+      _shards[k]->tree.swap(pieces[k - 1]);
+    _bounds.swap(bounds);
+  }
+
+  size_type _max_shards;
+  Compare _comp;
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::vector<value_type> _bounds;
+  std::atomic<size_type> _size {0};
+  std::atomic<bool> _rebalancing {false};
+  mutable Lock _layout;
+};
+
+template <typename T, typename Compare, typename Allocator, typename Augment>
+constexpr typename RBTreeSharded<T, Compare, Allocator, Augment>::size_type
+RBTreeSharded<T, Compare, Allocator, Augment>::min_shard_size;
+
+#endif // __RBTREE_SHARDED_HPP_INCLUDED
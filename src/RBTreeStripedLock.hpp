@@ -0,0 +1,84 @@
+#ifndef __RBTREE_STRIPED_LOCK_HPP_INCLUDED
+#define __RBTREE_STRIPED_LOCK_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+template <std::size_t>
+class RBTreeStripedLock;
+
+// readers-writer lock whose readers do not share a cache line
+//
+// Each thread counts itself into one of Stripes reader slots, so readers
+// on different cores never write the same line; a writer raises its flag
+// and waits for every slot to drain. Writers go first: a reader that sees
+// the flag backs out and waits. Meets SharedMutex, use std::shared_lock
+// and std::lock_guard with it. Readers and writers spin, so hold it only
+// for short critical sections.
+//
+// It is there for locks that nearly every operation takes in shared mode
+// and only rare ones exclusively: the shard layout of RBTreeSharded and
+// the whole-tree lock that RBTreeConcurrent's clear() and snapshot() use.
+template <std::size_t Stripes = 64>
+class RBTreeStripedLock {
+  static_assert(Stripes > 0, "Stripes must be positive");
+
+public:
+  RBTreeStripedLock() = default;
+  RBTreeStripedLock(const RBTreeStripedLock &) = delete;
+  RBTreeStripedLock &operator=(const RBTreeStripedLock &) = delete;
+
+///////////////////////////////////////////////////////////////////////////////
+// exclusive
+  void lock() {
+    _writers.lock();
+    _writing.store(true);
+    for (auto &s : _stripes)
+      while (s.readers.load())
+        std::this_thread::yield();
+  }
+  void unlock() noexcept {
+    _writing.store(false, std::memory_order_release);
+    _writers.unlock();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// shared
+  void lock_shared() noexcept {
+    auto &readers = _stripes[stripe()].readers;
+    while (true) {
+      // seq_cst pairs with the writer's store: one of us sees the other
+      readers.fetch_add(1);
+      if (!_writing.load()) return;
+      readers.fetch_sub(1, std::memory_order_release);
+      while (_writing.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+    }
+  }
+  void unlock_shared() noexcept {
+    _stripes[stripe()].readers.fetch_sub(1, std::memory_order_release);
+  }
+
+private:
+  // padded rather than aligned, new ignores over-alignment before C++17;
+  // two counters still never share a 64-byte line
+  struct Stripe {
+    std::atomic<std::size_t> readers {0};
+    char pad[64 - sizeof(std::atomic<std::size_t>)];
+  };
+
+  // threads are dealt stripes round robin, once
+  static std::size_t stripe() noexcept {
+    static std::atomic<std::size_t> next {0};
+    static thread_local std::size_t mine =
+      next.fetch_add(1, std::memory_order_relaxed) % Stripes;
+    return mine;
+  }
+
+  Stripe _stripes[Stripes];
+  std::atomic<bool> _writing {false};
+  std::mutex _writers;
+};
+
+#endif // __RBTREE_STRIPED_LOCK_HPP_INCLUDED
@@ -0,0 +1,202 @@
+#ifndef __RBTREE_THREAD_POOL_HPP_INCLUDED
+#define __RBTREE_THREAD_POOL_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+class RBTreeThreadPool;
+
+// Fork-join pool with one task deque per worker. A forking thread pushes
+// onto the back of its own deque and pops from there again, idle workers
+// steal from the front of the others; a thread waiting for a stolen task
+// runs other tasks meanwhile, so nested fork_join never blocks a worker.
+// Threads outside the pool share one extra deque.
+class RBTreeThreadPool {
+public:
+///////////////////////////////////////////////////////////////////////////////
+// ctor/dtor
+  explicit RBTreeThreadPool(
+      std::size_t threads = std::thread::hardware_concurrency())
+    : _queues(std::max<std::size_t>(threads, 1) + 1) {
+    for (auto &q : _queues) q.reset(new Queue);
+    for (std::size_t i = 0; i + 1 != _queues.size(); ++i)
+      _threads.emplace_back([this, i] {work(i);});
+  }
+  RBTreeThreadPool(const RBTreeThreadPool &) = delete;
+  RBTreeThreadPool &operator=(const RBTreeThreadPool &) = delete;
+
+  ~RBTreeThreadPool() noexcept {
+    {
+      std::lock_guard<std::mutex> lock(_idle_lock);
+      _stop = true;
+    }
+    _idle.notify_all();
+    for (auto &t : _threads) t.join();
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// query
+  std::size_t size() const noexcept {return _threads.size();}
+
+///////////////////////////////////////////////////////////////////////////////
+// fork-join
+  // run f and g, possibly in parallel, and return when both are done;
+  // the first exception thrown by either is rethrown. If g cannot be
+  // queued, both run here, one after the other.
+  template <class F, class G>
+  void fork_join(F &&f, G &&g) {
+    Job<G> job(g);
+    Queue &queue = own_queue();
+    bool queued = true;
+    try {
+      push(queue, &job);
+    } catch (...) {
+      queued = false;
+    }
+    std::exception_ptr error;
+    try {
+      f();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (!queued || take_back(queue, &job)) job.run();
+    else while (!job.done.load(std::memory_order_acquire)) {
+      if (!run_one(index())) std::this_thread::yield();
+    }
+    if (error) std::rethrow_exception(error);
+    if (job.error) std::rethrow_exception(job.error);
+  }
+
+private:
+  struct Task {
+    virtual void run() noexcept = 0;
+    std::atomic<bool> done {false};
+    std::exception_ptr error;
+  protected:
+    ~Task() = default;
+  };
+
+  template <class G>
+  struct Job : Task {
+    explicit Job(G &g) : g(g) {}
+    void run() noexcept override {
+      try {
+        g();
+      } catch (...) {
+        this->error = std::current_exception();
+      }
+      this->done.store(true, std::memory_order_release);
+    }
+    G &g;
+  };
+
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task*> tasks;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+// queues
+  // which queue the calling thread owns in this pool
+  std::size_t index() const noexcept {
+    return current().pool == this ? current().index : _queues.size() - 1;
+  }
+  Queue &own_queue() noexcept {return *_queues[index()];}
+
+  struct Current {
+    const RBTreeThreadPool *pool = nullptr;
+    std::size_t index = 0;
+  };
+  static Current &current() noexcept {
+    static thread_local Current curr;
+    return curr;
+  }
+
+  // queue task; if this throws, it was not queued
+  void push(Queue &queue, Task *task) {
+    {
+      std::lock_guard<std::mutex> lock(queue.lock);
+      queue.tasks.push_back(task);
+    }
+    announce();
+  }
+
+  // wake a worker for a queued task; the task may already be stolen, so
+  // its owner must not unwind from here
+  void announce() noexcept {
+    {
+      std::lock_guard<std::mutex> lock(_idle_lock);
+      ++_pending;
+    }
+    _idle.notify_one();
+  }
+
+  // pop task if nobody has stolen it yet
+  bool take_back(Queue &queue, Task *task) noexcept {
+    {
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if (queue.tasks.empty() || queue.tasks.back() != task) return false;
+      queue.tasks.pop_back();
+    }
+    std::lock_guard<std::mutex> lock(_idle_lock);
+    --_pending;
+    return true;
+  }
+
+  // newest task of queue i when i is ours, else the oldest
+  Task *take(std::size_t i, bool own) noexcept {
+    Queue &queue = *_queues[i];
+    Task *task = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if (queue.tasks.empty()) return nullptr;
+      if (own) {
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+      } else {
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+      }
+    }
+    std::lock_guard<std::mutex> lock(_idle_lock);
+    --_pending;
+    return task;
+  }
+
+  // run one task from our own queue or stolen from another
+  bool run_one(std::size_t self) noexcept {
+    Task *task = take(self, true);
+    for (std::size_t i = 1; !task && i != _queues.size(); ++i)
+      task = take((self + i) % _queues.size(), false);
+    if (!task) return false;
+    task->run();
+    return true;
+  }
+
+  void work(std::size_t self) noexcept {
+    current() = {this, self};
+    while (true) {
+      if (run_one(self)) continue;
+      std::unique_lock<std::mutex> lock(_idle_lock);
+      _idle.wait(lock, [this] {return _stop || _pending;});
+      if (_stop) return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> _queues; // workers', then outsiders'
+  std::vector<std::thread> _threads;
+  std::mutex _idle_lock;
+  std::condition_variable _idle;
+  std::size_t _pending = 0; // queued tasks, guarded by _idle_lock
+  bool _stop = false;
+};
+
+#endif // __RBTREE_THREAD_POOL_HPP_INCLUDED
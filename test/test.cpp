@@ -1,16 +1,33 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <set>
+#include <thread>
+#include <type_traits>
 #include <unordered_set>
 #include <utility>
 #include <RBTree.hpp>
+#include <RBTreeBuffered.hpp>
+#include <RBTreeCompact.hpp>
+#include <RBTreeConcurrent.hpp>
+#include <RBTreeFrozen.hpp>
+#include <RBTreeIntervalTree.hpp>
+#include <RBTreePersistent.hpp>
+#include <RBTreePoolAllocator.hpp>
+#include <RBTreeRCU.hpp>
+#include <RBTreeSharded.hpp>
+#include <RBTreeThreadPool.hpp>
 
 static std::size_t multiplier = 1;
 
@@ -129,11 +146,11 @@ void testInsertion()
 {
   RBTree<int> rbti;
   using pNode = RBTree<int>::pNode;
-  pNode p;
+  pNode p = nullptr;
   std::pair<pNode, bool> fr = rbti.find(rbti._root, 4, p);
   cout << fr.first << ' ' << fr.second << ' ' << p << endl;
   auto ir = rbti.insert(4);
-  cout << ir.first.lock() << ' ' << ir.second << endl;
+  cout << ir.first.node() << ' ' << ir.second << endl;
   cout << rbti._root << ' ' 
   //     << rbti._rend << ' '
   //     << rbti._rend->next().lock() << ' '
@@ -144,18 +161,18 @@ void testInsertion()
        << *rbti.end() << ' '
        << endl;
 
-  p.reset();
+  p = nullptr;
   fr = rbti.find(rbti._root, 3, p);
   cout << fr.first << ' ' << fr.second << ' ' << p << endl;
-  p.reset();
+  p = nullptr;
   fr = rbti.find(rbti._root, 4, p);
   cout << fr.first << ' ' << fr.second << ' ' << p << endl;
-  p.reset();
+  p = nullptr;
   fr = rbti.find(rbti._root, 5, p);
   cout << fr.first << ' ' << fr.second << ' ' << p << endl;
 
   ir = rbti.insert(3);
-  cout << ir.first.lock() << ' ' << ir.second << endl;
+  cout << ir.first.node() << ' ' << ir.second << endl;
   cout << rbti._root << ' ' 
   //     << rbti._rend << ' '
   //     << rbti._rend->next().lock() << ' '
@@ -173,7 +190,8 @@ void testInsertion()
   //crbti.find(3);
 }
 
-void check_validity(set<int> &si, RBTree<int> &rbti)
+template <typename Tree>
+void check_validity(set<int> &si, Tree &rbti)
 {
   assert(rbti.check_parent());
   assert(rbti.is_valid_rb_tree());
@@ -270,6 +288,1327 @@ void testRandomInsertion(std::size_t num)
 
 }
 
+void testBounds(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTree<int> rbti;
+  std::set<int> si;
+  assert(rbti.lower_bound(0) == rbti.end());
+  assert(!rbti.contains(0));
+  for (std::size_t i = 0; i != num / 2; ++i) {
+    auto x = dist(mt) * 2;
+    rbti.insert(x);
+    si.insert(x);
+  }
+
+  const RBTree<int> &crbti = rbti;
+  for (int x = -1; x <= static_cast<int>(num) * 2 + 1; ++x) {
+    auto lb = crbti.lower_bound(x);
+    auto ub = crbti.upper_bound(x);
+    auto slb = si.lower_bound(x);
+    auto sub = si.upper_bound(x);
+    assert(slb == si.end() ? lb == crbti.cend() : *lb == *slb);
+    assert(sub == si.end() ? ub == crbti.cend() : *ub == *sub);
+    assert(rbti.lower_bound(x) == lb);
+    assert(rbti.upper_bound(x) == ub);
+    auto er = crbti.equal_range(x);
+    assert(er.first == lb && er.second == ub);
+    assert(crbti.count(x) == si.count(x));
+    assert(crbti.contains(x) == (si.find(x) != si.end()));
+    assert((crbti.find(x) == crbti.cend()) == (si.find(x) == si.end()));
+    assert(crbti.find(x) == rbti.find(x));
+  }
+}
+
+void testHintedInsertion(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTree<int> rbti;
+  std::set<int> si;
+  // appends at end()
+  for (std::size_t i = 0; i != num; ++i) {
+    auto it = rbti.insert(rbti.cend(), static_cast<int>(i) * 2);
+    assert(*it == static_cast<int>(i) * 2);
+    si.insert(si.end(), i * 2);
+  }
+  check_validity(si, rbti);
+
+  // right and wrong hints
+  for (std::size_t i = 0; i != num; ++i) {
+    auto x = dist(mt);
+    auto hint = rbti.lower_bound(x + dist(mt) % 3 - 1);
+    auto it = rbti.insert(hint, x);
+    assert(*it == x);
+    si.insert(x);
+    check_validity(si, rbti);
+  }
+
+  RBTree<std::pair<int, int>> rbtp;
+  std::set<std::pair<int, int>> sp;
+  for (std::size_t i = 0; i != num; ++i) {
+    auto x = dist(mt), y = dist(mt) % 2;
+    auto it = rbtp.emplace_hint(rbtp.upper_bound({x, y}), x, y);
+    assert(*it == std::make_pair(x, y));
+    sp.emplace_hint(sp.end(), x, y);
+  }
+  assert(rbtp.size() == sp.size());
+  assert(std::equal(sp.begin(), sp.end(), rbtp.begin()));
+
+  std::vector<int> seq(si.begin(), si.end());
+  RBTree<int> rbti2;
+  rbti2.insert(seq.begin(), seq.end());
+  rbti2.insert(seq.rbegin(), seq.rend());
+  check_validity(si, rbti2);
+}
+
+void testSortedConstruction(std::size_t num)
+{
+  std::set<int> si;
+  for (std::size_t n = 0; n != num; ++n) {
+    std::vector<int> seq(si.begin(), si.end());
+    RBTree<int> rbti(sorted_unique, seq.begin(), seq.end());
+    check_validity(si, rbti);
+    RBTree<int> rbti2(si.begin(), si.end());
+    check_validity(si, rbti2);
+    rbti2.insert(-1);
+    rbti2.erase(-1);
+    check_validity(si, rbti2);
+    si.insert(n * 3);
+  }
+
+  // unsorted forward range falls back to insertion
+  std::vector<int> seq(si.rbegin(), si.rend());
+  RBTree<int> rbti(seq.begin(), seq.end());
+  check_validity(si, rbti);
+  seq.push_back(seq.back());
+  RBTree<int> rbti2(seq.rbegin(), seq.rend());
+  check_validity(si, rbti2);
+}
+
+struct Heavy {
+  int key;
+  std::vector<int> buf;
+  Heavy() : key() {}
+  Heavy(int key) : key(key), buf(16, key) {}
+  Heavy(const Heavy &) = default;
+  Heavy(Heavy &&) = default;
+  Heavy &operator=(const Heavy &) = default;
+  Heavy &operator=(Heavy &&) = default;
+  bool operator<(const Heavy &other) const {return key < other.key;}
+};
+
+void testMoveInsertion(std::size_t num)
+{
+  RBTree<Heavy> rbth;
+  for (std::size_t i = 0; i != num; ++i) {
+    Heavy h(i * 2);
+    const int *buf = h.buf.data();
+    auto ir = rbth.insert(std::move(h));
+    assert(ir.second && ir.first->buf.data() == buf);
+    Heavy h2(i * 2 + 1);
+    buf = h2.buf.data();
+    auto it = rbth.insert(rbth.cend(), std::move(h2));
+    assert(it->buf.data() == buf);
+  }
+  auto er = rbth.emplace(3);
+  assert(!er.second && er.first->key == 3);
+  er = rbth.emplace(-1);
+  assert(er.second && er.first->key == -1 && rbth.begin() == er.first);
+  assert(rbth.size() == num * 2 + 1);
+
+  // move nodes between trees without reallocation
+  RBTree<Heavy> rbth2;
+  std::set<int> si, si2;
+  for (const auto &h : rbth) si.insert(h.key);
+  for (std::size_t i = 0; i != num; ++i) {
+    auto it = rbth.find(static_cast<int>(i));
+    const Heavy *addr = &*it;
+    auto nh = rbth.extract(it);
+    assert(!nh.empty() && &nh.value() == addr);
+    auto ir = rbth2.insert(std::move(nh));
+    assert(ir.inserted && &*ir.position == addr && ir.node.empty());
+    si.erase(i);
+    si2.insert(i);
+  }
+  assert(rbth.extract(Heavy(0)).empty());
+  std::set<int> keys, keys2;
+  for (const auto &h : rbth) keys.insert(h.key);
+  for (const auto &h : rbth2) keys2.insert(h.key);
+  assert(keys == si && rbth.size() == si.size());
+  assert(keys2 == si2 && rbth2.size() == si2.size());
+
+  // re-key a node, and reinsert a duplicate
+  auto nh = rbth2.extract(rbth2.begin());
+  nh.value().key = static_cast<int>(num) * 10;
+  auto it = rbth2.insert(rbth2.end(), std::move(nh));
+  assert(it->key == static_cast<int>(num) * 10);
+  assert(std::prev(rbth2.end()) == it);
+  nh = rbth2.extract(Heavy(1));
+  nh.value().key = 2;
+  auto ir = rbth2.insert(std::move(nh));
+  assert(!ir.inserted && ir.node && ir.position->key == 2);
+
+  RBTree<int> rbti;
+  std::set<int> si3;
+  rbti.insert(1);
+  si3.insert(1);
+  auto nhi = rbti.extract(rbti.begin());
+  si3.clear();
+  check_validity(si3, rbti);
+  rbti.insert(std::move(nhi));
+  si3.insert(1);
+  check_validity(si3, rbti);
+}
+
+void testOrderStatistics(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTree<int> rbti;
+  std::set<int> si;
+  assert(rbti.nth(0) == rbti.end());
+  assert(rbti.rank(0) == 0);
+  for (std::size_t i = 0; i != num * 2; ++i) {
+    auto x = dist(mt);
+    if (i % 3 == 2) {
+      rbti.erase(x);
+      si.erase(x);
+    } else {
+      rbti.insert(x);
+      si.insert(x);
+    }
+    check_validity(si, rbti);
+  }
+
+  const RBTree<int> &crbti = rbti;
+  std::vector<int> seq(si.begin(), si.end());
+  for (std::size_t k = 0; k != seq.size(); ++k) {
+    assert(*crbti.nth(k) == seq[k]);
+    assert(crbti.index_of(rbti.nth(k)) == k);
+  }
+  assert(crbti.nth(seq.size()) == crbti.cend());
+  assert(crbti.index_of(crbti.cend()) == seq.size());
+  for (int x = -1; x <= static_cast<int>(num) + 1; ++x) {
+    assert(crbti.rank(x) == static_cast<std::size_t>(
+          std::lower_bound(seq.begin(), seq.end(), x) - seq.begin()));
+    auto lo = crbti.lower_bound(x), hi = crbti.upper_bound(x + 10);
+    assert(crbti.distance(lo, hi) == std::distance(lo, hi));
+  }
+
+  RBTree<int> rbti2(rbti);
+  check_validity(si, rbti2);
+  RBTree<int> rbti3(sorted_unique, seq.begin(), seq.end());
+  check_validity(si, rbti3);
+  auto nh = rbti3.extract(rbti3.nth(seq.size() / 2));
+  rbti3.insert(std::move(nh));
+  check_validity(si, rbti3);
+}
+
+// bit i set if some element has i as its lowest set bit
+struct LowBitAugment {
+  using aggregate_type = unsigned;
+  aggregate_type identity() const {return 0;}
+  aggregate_type lift(int value) const {return value & -value;}
+  aggregate_type combine(aggregate_type lhs, aggregate_type rhs) const
+  {return lhs | rhs;}
+};
+
+template <typename Tree, typename Fold>
+void check_aggregates(const Tree &rbt, const std::set<int> &si, 
+    typename Tree::aggregate_type init, Fold fold, std::mt19937 &mt, 
+    int range)
+{
+  assert(rbt.aggregate() == std::accumulate(si.begin(), si.end(), init, fold));
+  std::uniform_int_distribution<int> dist(-1, range + 1);
+  for (int i = 0; i != 20; ++i) {
+    int lo = dist(mt), hi = dist(mt);
+    assert(rbt.aggregate(lo, hi) == std::accumulate(
+          si.lower_bound(lo), lo < hi ? si.lower_bound(hi) : si.lower_bound(lo),
+          init, fold));
+  }
+}
+
+void testAugment(std::size_t num)
+{
+  using SumTree = RBTree<int, std::less<int>, std::allocator<int>,
+        RBTreeSumAugment<long>>;
+  using MinTree = RBTree<int, std::less<int>, std::allocator<int>,
+        RBTreeMinAugment<int>>;
+  using MaxTree = RBTree<int, std::less<int>, std::allocator<int>,
+        RBTreeMaxAugment<int>>;
+  using LowBitTree = RBTree<int, std::less<int>, std::allocator<int>,
+        LowBitAugment>;
+  // no aggregate costs no bytes: the value, five links, size and color
+  struct NodeLayout {
+    int value;
+    void *links[5];
+    std::uint32_t size;
+    unsigned char color;
+  };
+  static_assert(sizeof(RBTreeNode<int, RBTreeNoAugment>) ==
+      sizeof(NodeLayout), "");
+  static_assert(sizeof(RBTreeNode<int, RBTreeSumAugment<long>>) >
+      sizeof(RBTreeNode<int, RBTreeNoAugment>), "");
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  int range = static_cast<int>(num);
+  std::uniform_int_distribution<int> dist(1, range);
+
+  auto sum = [](long acc, int x) {return acc + x;};
+  auto min = [](int acc, int x) {return std::min(acc, x);};
+  auto max = [](int acc, int x) {return std::max(acc, x);};
+  auto low = [](unsigned acc, int x) {return acc | unsigned(x & -x);};
+
+  SumTree sumt;
+  MinTree mint;
+  MaxTree maxt;
+  LowBitTree lowt;
+  std::set<int> si;
+  assert(sumt.aggregate() == 0);
+  assert(mint.aggregate() == std::numeric_limits<int>::max());
+  for (std::size_t i = 0; i != num * 2; ++i) {
+    auto x = dist(mt);
+    if (i % 3 == 2) {
+      sumt.erase(x);
+      mint.erase(x);
+      auto nh = maxt.extract(x);
+      if (nh) {
+        // move the key and put the node back
+        nh.value() += range;
+        maxt.insert(std::move(nh));
+        maxt.erase(x + range);
+      }
+      lowt.erase(x);
+      si.erase(x);
+    } else {
+      sumt.insert(x);
+      mint.emplace_hint(mint.lower_bound(x), x);
+      maxt.insert(x);
+      lowt.insert(x);
+      si.insert(x);
+    }
+    check_validity(si, sumt);
+    check_validity(si, lowt);
+    if (i % 16 == 0) {
+      check_aggregates(sumt, si, 0L, sum, mt, range);
+      check_aggregates(mint, si, std::numeric_limits<int>::max(), min, mt, 
+          range);
+      check_aggregates(maxt, si, std::numeric_limits<int>::lowest(), max, mt,
+          range);
+      check_aggregates(lowt, si, 0u, low, mt, range);
+    }
+  }
+
+  std::vector<int> seq(si.begin(), si.end());
+  SumTree sumt2(sorted_unique, seq.begin(), seq.end());
+  check_validity(si, sumt2);
+  check_aggregates(sumt2, si, 0L, sum, mt, range);
+  SumTree sumt3(sumt2);
+  check_validity(si, sumt3);
+  check_aggregates(sumt3, si, 0L, sum, mt, range);
+  sumt3.erase(sumt3.begin(), sumt3.nth(seq.size() / 2));
+  si.erase(si.begin(), si.lower_bound(*sumt3.begin()));
+  check_validity(si, sumt3);
+  check_aggregates(sumt3, si, 0L, sum, mt, range);
+}
+
+void testIntervalTree(std::size_t num)
+{
+  using Interval = std::pair<int, int>;
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  int range = static_cast<int>(num);
+  std::uniform_int_distribution<int> dist(0, range);
+  std::uniform_int_distribution<int> length(1, 20);
+
+  RBTreeIntervalTree<int> it;
+  std::set<Interval> si;
+  std::vector<Interval> result;
+  assert(it.find_overlap(0, range) == it.end());
+  for (std::size_t i = 0; i != num * 2; ++i) {
+    int start = dist(mt);
+    if (i % 4 == 3 && !si.empty()) {
+      auto victim = *si.lower_bound({start, 0});
+      assert(it.erase(victim) == si.erase(victim));
+    } else {
+      int end = start + length(mt);
+      assert(it.insert(start, end).second == si.emplace(start, end).second);
+    }
+    assert(it.check_parent());
+    assert(it.is_valid_rb_tree());
+    assert(std::equal(si.begin(), si.end(), it.begin()));
+    if (!si.empty()) {
+      int max_end = 0;
+      for (auto &x : si) max_end = std::max(max_end, x.second);
+      assert(it.max_end() == max_end);
+    }
+
+    int lo = dist(mt), hi = lo + length(mt) - 5;
+    std::vector<Interval> expected;
+    for (auto &x : si)
+      if (x.first <= lo && lo < x.second) expected.push_back(x);
+    result.clear();
+    it.stab(lo, std::back_inserter(result));
+    assert(result == expected);
+
+    expected.clear();
+    // [lo, hi) is empty when hi <= lo
+    for (auto &x : si)
+      if (lo < hi && x.first < hi && lo < x.second) expected.push_back(x);
+    result.clear();
+    it.overlap(lo, hi, std::back_inserter(result));
+    assert(result == expected);
+    auto first = it.find_overlap(lo, hi);
+    if (expected.empty()) assert(first == it.end());
+    else assert(*first == expected.front());
+  }
+}
+
+void testSetAlgebra(std::size_t num)
+{
+  using SumTree = RBTree<int, std::less<int>, std::allocator<int>,
+        RBTreeSumAugment<long>>;
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  int range = static_cast<int>(num);
+  std::uniform_int_distribution<int> dist(0, range);
+  std::uniform_int_distribution<std::size_t> count(0, num);
+
+  auto random_set = [&](std::size_t n) {
+    std::set<int> si;
+    while (n--) si.insert(dist(mt));
+    return si;
+  };
+  auto check_sum = [](const SumTree &t, const std::set<int> &si) {
+    assert(t.aggregate() == std::accumulate(si.begin(), si.end(), 0L));
+  };
+
+  for (int round = 0; round != 20; ++round) {
+    // uneven sizes exercise the uneven joins, and the one by one relink
+    // for tiny deltas
+    std::size_t divisor[] = {1, 16, 256};
+    std::set<int> sa = random_set(count(mt)), 
+                  sb = random_set(count(mt) / divisor[round % 3]);
+    std::set<int> expected, none;
+
+    // split, then join back
+    SumTree a(sa.begin(), sa.end());
+    int key = dist(mt);
+    SumTree right = a.split(key);
+    std::set<int> sl(sa.begin(), sa.lower_bound(key)), 
+                  sr(sa.lower_bound(key), sa.end());
+    check_validity(sl, a);
+    check_validity(sr, right);
+    check_sum(a, sl);
+    check_sum(right, sr);
+    a.join(std::move(right));
+    check_validity(sa, a);
+    check_validity(none, right);
+    check_sum(a, sa);
+
+    // join around a new middle value
+    SumTree left(sa.begin(), sa.lower_bound(key));
+    SumTree rest(sa.upper_bound(key), sa.end());
+    left.join(key, std::move(rest));
+    sl = sa;
+    sl.insert(key);
+    check_validity(sl, left);
+    check_validity(none, rest);
+    check_sum(left, sl);
+
+    // union
+    SumTree u(sa.begin(), sa.end()), v(sb.begin(), sb.end());
+    std::set_union(sa.begin(), sa.end(), sb.begin(), sb.end(),
+        std::inserter(expected, expected.end()));
+    u.set_union(std::move(v));
+    check_validity(expected, u);
+    check_validity(none, v);
+    check_sum(u, expected);
+
+    // intersection
+    expected.clear();
+    SumTree i(sa.begin(), sa.end()), j(sb.begin(), sb.end());
+    std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(),
+        std::inserter(expected, expected.end()));
+    i.set_intersection(std::move(j));
+    check_validity(expected, i);
+    check_sum(i, expected);
+    assert(j.empty());
+
+    // difference, both ways
+    expected.clear();
+    SumTree d(sa.begin(), sa.end()), e(sb.begin(), sb.end());
+    std::set_difference(sa.begin(), sa.end(), sb.begin(), sb.end(),
+        std::inserter(expected, expected.end()));
+    d.set_difference(std::move(e));
+    check_validity(expected, d);
+    check_sum(d, expected);
+    assert(e.empty());
+    expected.clear();
+    SumTree f(sa.begin(), sa.end()), g(sb.begin(), sb.end());
+    std::set_difference(sb.begin(), sb.end(), sa.begin(), sa.end(),
+        std::inserter(expected, expected.end()));
+    g.set_difference(std::move(f));
+    check_validity(expected, g);
+    assert(f.empty());
+
+    // merge leaves the duplicates behind, like std::set::merge
+    SumTree m(sa.begin(), sa.end()), n(sb.begin(), sb.end());
+    std::set<int> sm(sa), sn;
+    for (int x : sb) 
+      if (!sm.insert(x).second) sn.insert(x);
+    m.merge(n);
+    check_validity(sm, m);
+    check_validity(sn, n);
+    check_sum(m, sm);
+    check_sum(n, sn);
+    // the merged trees stay usable
+    m.insert(range + 1);
+    n.insert(range + 1);
+    m.erase(m.begin());
+    sm.insert(range + 1);
+    sn.insert(range + 1);
+    sm.erase(sm.begin());
+    check_validity(sm, m);
+    check_validity(sn, n);
+  }
+}
+
+void testParallelSetAlgebra(std::size_t num)
+{
+  // the pool allocator is not thread safe, so this also checks that the
+  // parallel operations only allocate and free from the calling thread
+  using PoolTree = RBTree<int, std::less<int>, RBTreePoolAllocator<int>>;
+  RBTreeThreadPool pool(4);
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  int range = static_cast<int>(num * 64);
+  std::uniform_int_distribution<int> dist(0, range);
+
+  auto random_vector = [&](std::size_t n) {
+    std::vector<int> vec(n);
+    for (auto &x : vec) x = dist(mt);
+    std::sort(vec.begin(), vec.end());
+    vec.erase(std::unique(vec.begin(), vec.end()), vec.end());
+    return vec;
+  };
+
+  // trees built from one allocator share its pool
+  RBTreePoolAllocator<int> alloc;
+  auto make_tree = [&alloc](const std::vector<int> &vec) {
+    PoolTree tree(std::less<int>(), alloc);
+    tree.insert(vec.begin(), vec.end());
+    return tree;
+  };
+  for (int round = 0; round != 4; ++round) {
+    auto va = random_vector(num * 32), vb = random_vector(num * (8 << round));
+    PoolTree a = make_tree(va), b = make_tree(vb);
+    std::set<int> expected;
+    std::set_union(va.begin(), va.end(), vb.begin(), vb.end(),
+        std::inserter(expected, expected.end()));
+    a.set_union(std::move(b), pool);
+    check_validity(expected, a);
+    assert(b.empty());
+
+    PoolTree c = make_tree(vb);
+    std::set<int> sa(a.begin(), a.end());
+    expected.clear();
+    std::set_intersection(sa.begin(), sa.end(), vb.begin(), vb.end(),
+        std::inserter(expected, expected.end()));
+    a.set_intersection(std::move(c), pool);
+    check_validity(expected, a);
+    assert(c.empty());
+
+    PoolTree d = make_tree(va), e = make_tree(vb);
+    expected.clear();
+    std::set_difference(va.begin(), va.end(), vb.begin(), vb.end(),
+        std::inserter(expected, expected.end()));
+    d.set_difference(std::move(e), pool);
+    check_validity(expected, d);
+    assert(e.empty());
+  }
+
+  // exceptions cross the fork
+  bool caught = false;
+  try {
+    pool.fork_join([] {}, [] {throw 1;});
+  } catch (int) {
+    caught = true;
+  }
+  assert(caught);
+
+  // a throwing f still waits for g, which runs exactly once
+  std::atomic<int> runs {0};
+  caught = false;
+  try {
+    pool.fork_join([] {throw 1;}, [&runs] {++runs;});
+  } catch (int) {
+    caught = true;
+  }
+  assert(caught && runs == 1);
+}
+
+void testPoolAllocator(std::size_t num)
+{
+  using PoolTree = RBTree<int, std::less<int>, RBTreePoolAllocator<int, 64>>;
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  PoolTree rbti;
+  std::set<int> si;
+  for (std::size_t i = 0; i != num; ++i) {
+    auto x = dist(mt);
+    rbti.insert(x);
+    si.insert(x);
+    x = dist(mt);
+    rbti.erase(x);
+    si.erase(x);
+  }
+  check_validity(si, rbti);
+
+  // a copy gets a pool of its own, and each tree keeps one
+  PoolTree rbti2(rbti);
+  assert(rbti.get_allocator() == rbti.get_allocator());
+  assert(rbti2.get_allocator() != rbti.get_allocator());
+  check_validity(si, rbti2);
+  rbti.clear();
+  for (auto x : si) rbti.insert(x);
+  check_validity(si, rbti);
+  swap(rbti, rbti2);
+  check_validity(si, rbti);
+
+  // clear() drops the whole pool, but not while a split-off tree or a node
+  // handle still lives in it
+  static_assert(std::is_trivially_destructible<RBTreeNode<int>>::value,
+      "int nodes need no destructor");
+  std::set<int> upper_si(si.lower_bound(*rbti.nth(si.size() / 2)),
+                         si.end());
+  auto upper = rbti.split(*upper_si.begin());
+  auto nh = rbti.extract(rbti.begin());
+  rbti.clear();
+  check_validity(upper_si, upper);
+  assert(nh.value() == *si.begin());
+  upper.insert(std::move(nh));
+  upper_si.insert(*si.begin());
+  check_validity(upper_si, upper);
+  upper.clear();
+  for (auto x : si) upper.insert(x);
+  check_validity(si, upper);
+
+  // trees built from one allocator share its pool, so they can be joined
+  // and united, and trade nodes
+  RBTreePoolAllocator<int, 64> alloc;
+  {
+    PoolTree lower(std::less<int>(), alloc), higher(std::less<int>(), alloc),
+             more(std::less<int>(), alloc);
+    assert(lower.get_allocator() == alloc);
+    assert(higher.get_allocator() == lower.get_allocator());
+    std::set<int> joined_si;
+    for (int i = 0; i != static_cast<int>(num); ++i) {
+      lower.insert(i);
+      higher.insert(i + static_cast<int>(num));
+      more.insert(i * 3);
+      joined_si.insert(i);
+      joined_si.insert(i + static_cast<int>(num));
+    }
+    lower.join(std::move(higher));
+    check_validity(joined_si, lower);
+    for (int i = 0; i != static_cast<int>(num); ++i) joined_si.insert(i * 3);
+    lower.set_union(std::move(more));
+    check_validity(joined_si, lower);
+    higher.insert(lower.extract(lower.begin()));
+    assert(*higher.begin() == 0);
+  }
+
+  RBTreePoolAllocator<int, 64> alloc2(alloc);
+  assert(alloc == alloc2);
+  RBTreePoolAllocator<RBTreeNode<int>, 64> rebound(alloc);
+  RBTreePoolAllocator<int, 64> back(rebound);
+  assert(rebound == alloc && back == alloc);
+  int *p = alloc.allocate(1);
+  alloc2.deallocate(p, 1);
+  assert(alloc.allocate(1) == p);
+  // a reservation is contiguous even with freed blocks about, and the
+  // tail of the chunk before it is used afterwards
+  const std::size_t stride = sizeof(void*) / sizeof(int);
+  int *freed = alloc.allocate(1);
+  alloc.deallocate(freed, 1);
+  alloc.reserve(1000);
+  assert(alloc.chunk_count() == 2);
+  int *reserved = alloc.allocate(1);
+  for (std::size_t i = 1; i != 1000; ++i)
+    assert(alloc.allocate(1) == reserved + i * stride);
+  assert(alloc.allocate(1) == freed);
+  assert(alloc.allocate(1) == freed + stride);
+  assert(alloc.chunk_count() == 2);
+  alloc.release();
+  assert(alloc2.chunk_count() == 0);
+}
+
+void testCompact(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTreeCompact<int> rbti;
+  std::set<int> si;
+  check_validity(si, rbti);
+  assert(sizeof(RBTreeCompactNode<int>) == 16);
+
+  std::vector<RBTreeCompact<int>::iterator> vitrbti;
+  for (std::size_t i = 0; i != num; ++i) {
+    auto x = dist(mt);
+    auto ir = rbti.insert(x);
+    assert(ir.second == si.insert(x).second);
+    if (ir.second) vitrbti.push_back(ir.first);
+    assert(*ir.first == x);
+    check_validity(si, rbti);
+  }
+  // iterators survive reallocation of the node vector
+  for (const auto &it : vitrbti) assert(si.count(*it));
+
+  for (std::size_t i = 0; i != num; ++i) {
+    auto x = dist(mt);
+    assert((rbti.find(x) == rbti.end()) == (si.find(x) == si.end()));
+    if (i % 2) {
+      assert(rbti.erase(x) == si.erase(x));
+    } else if (!si.empty()) {
+      auto it = rbti.begin();
+      std::advance(it, x % si.size());
+      auto its = si.begin();
+      std::advance(its, x % si.size());
+      auto next = rbti.erase(it);
+      its = si.erase(its);
+      assert(its == si.end() ? next == rbti.end() : *next == *its);
+    }
+    check_validity(si, rbti);
+    rbti.insert(x + 1);
+    si.insert(x + 1);
+    check_validity(si, rbti);
+  }
+
+  RBTreeCompact<int> rbti2(rbti);
+  check_validity(si, rbti2);
+
+  // a move steals the nodes and leaves an empty tree that owns nothing
+  static_assert(std::is_nothrow_move_constructible<
+      RBTreeCompact<int>>::value, "");
+  RBTreeCompact<int> rbti3(std::move(rbti2));
+  check_validity(si, rbti3);
+  assert(rbti2.empty() && rbti2.capacity() == 0);
+  assert(rbti2.begin() == rbti2.end());
+  assert(rbti2.find(0) == rbti2.end());
+  std::set<int> empty;
+  check_validity(empty, rbti2);
+  assert(rbti2.insert(1).second && *rbti2.begin() == 1);
+
+  rbti3.erase(rbti3.begin(), rbti3.end());
+  si.clear();
+  check_validity(si, rbti3);
+  rbti.clear();
+  check_validity(si, rbti);
+  assert(rbti.insert(1).second && rbti.size() == 1);
+
+  // erasing lets go of the value at once, not when the slot is reused
+  auto held = std::make_shared<int>(0);
+  RBTreeCompact<std::shared_ptr<int>> rbtp;
+  rbtp.insert(held);
+  assert(held.use_count() == 2);
+  assert(rbtp.erase(held) == 1);
+  assert(held.use_count() == 1);
+  rbtp.insert(held);
+  rbtp.clear();
+  assert(held.use_count() == 1);
+}
+
+// copying throws once copies_left runs out
+struct Fragile {
+  static std::atomic<int> copies_left;
+  int key = 0;
+  Fragile() = default;
+  Fragile(int key) : key(key) {}
+  Fragile(const Fragile &other) : key(other.key) {
+    if (copies_left.fetch_sub(1) == 0) throw std::bad_alloc();
+  }
+  Fragile &operator=(const Fragile &) = default;
+  bool operator<(const Fragile &other) const {return key < other.key;}
+};
+std::atomic<int> Fragile::copies_left(std::numeric_limits<int>::max());
+
+void testPersistent(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTreePersistent<int> rbti;
+  std::set<int> si;
+  std::vector<std::pair<RBTreePersistent<int>, std::set<int>>> versions;
+  auto check = [](const RBTreePersistent<int> &t, const std::set<int> &s) {
+    assert(t.is_valid_rb_tree());
+    assert(t.size() == s.size());
+    assert(std::equal(s.begin(), s.end(), t.begin(), t.end()));
+    assert(std::equal(s.rbegin(), s.rend(), t.rbegin(), t.rend()));
+  };
+  check(rbti, si);
+  for (std::size_t i = 0; i != num * 2; ++i) {
+    auto x = dist(mt);
+    if (i % 3 == 2) assert(rbti.erase(x) == si.erase(x));
+    else assert(rbti.insert(x).second == si.insert(x).second);
+    if (i % 16 == 0) versions.emplace_back(rbti.snapshot(), si);
+    check(rbti, si);
+
+    auto y = dist(mt);
+    auto lb = rbti.lower_bound(y);
+    auto slb = si.lower_bound(y);
+    assert(slb == si.end() ? lb == rbti.end() : *lb == *slb);
+    auto ub = rbti.upper_bound(y);
+    auto sub = si.upper_bound(y);
+    assert(sub == si.end() ? ub == rbti.end() : *ub == *sub);
+    assert(rbti.contains(y) == (si.count(y) != 0));
+    assert((rbti.find(y) == rbti.end()) == (si.find(y) == si.end()));
+  }
+  // old versions are untouched by the writes after them
+  for (const auto &v : versions) check(v.first, v.second);
+
+  // writing to a copy leaves the original alone, and dropping versions in
+  // any order frees the right nodes
+  auto copy = versions.front().first;
+  auto expected = versions.front().second;
+  for (auto x : si) {
+    copy.insert(x);
+    expected.insert(x);
+  }
+  check(copy, expected);
+  check(versions.front().first, versions.front().second);
+  std::shuffle(versions.begin(), versions.end(), mt);
+  while (!versions.empty()) {
+    versions.pop_back();
+    for (const auto &v : versions) check(v.first, v.second);
+  }
+  for (auto x : expected) copy.erase(x);
+  check(copy, {});
+  check(rbti, si);
+
+  // a snapshot is a plain tree that can be moved from and written to
+  static_assert(!std::is_const<decltype(rbti.snapshot())>::value, "");
+  RBTreePersistent<int> moved(rbti.snapshot());
+  moved.insert(static_cast<int>(num) + 1);
+  expected = si;
+  expected.insert(static_cast<int>(num) + 1);
+  check(moved, expected);
+  check(rbti, si);
+
+  // an erase whose copies throw leaves the tree as it was, whether its
+  // nodes are shared or not
+  for (bool shared : {false, true}) {
+    RBTreePersistent<Fragile> fragile;
+    for (int i = 0; i != static_cast<int>(num); ++i) fragile.insert(i);
+    auto before = fragile.snapshot();
+    if (!shared) before = RBTreePersistent<Fragile>();
+    for (int left = 0; ; ++left) {
+      Fragile::copies_left = left;
+      int x = left * 7 % static_cast<int>(num);
+      try {
+        fragile.erase(x);
+      } catch (const std::bad_alloc &) {
+        Fragile::copies_left = std::numeric_limits<int>::max();
+        assert(fragile.is_valid_rb_tree());
+        assert(fragile.size() == num && fragile.contains(x));
+        continue;
+      }
+      Fragile::copies_left = std::numeric_limits<int>::max();
+      assert(fragile.is_valid_rb_tree());
+      assert(fragile.size() == num - 1 && !fragile.contains(x));
+      break;
+    }
+    for (int i = 0; shared && i != static_cast<int>(num); ++i)
+      assert(before.contains(i));
+  }
+}
+
+void testConcurrent(std::size_t num)
+{
+  const int threads = 4;
+  RBTreeConcurrent<int> rbti;
+  std::vector<std::set<int>> owned(threads);
+  std::vector<std::thread> workers;
+  // writer t owns the values equal to t modulo threads, so all of them
+  // work on the same paths but each knows what its own values must be
+  for (int t = 0; t != threads; ++t) {
+    workers.emplace_back([&rbti, &owned, t, num] {
+      std::mt19937 mt(t);
+      std::uniform_int_distribution<int> dist(0, num / 4);
+      std::set<int> &si = owned[t];
+      for (std::size_t i = 0; i != num; ++i) {
+        int x = dist(mt) * threads + t;
+        if (i % 2) assert(rbti.insert(x) == si.insert(x).second);
+        else assert(rbti.erase(x) == si.erase(x));
+        assert(rbti.contains(x) == (si.count(x) != 0));
+        int y = -1;
+        assert(rbti.find(x, y) == (si.count(x) != 0));
+        if (rbti.lower_bound(x, y)) assert(y >= x);
+        if (rbti.upper_bound(x, y)) assert(y > x);
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+
+  std::set<int> si;
+  for (const auto &s : owned) si.insert(s.begin(), s.end());
+  assert(rbti.is_valid_rb_tree());
+  assert(rbti.size() == si.size());
+  auto copy = rbti.snapshot();
+  assert(std::equal(si.begin(), si.end(), copy.begin(), copy.end()));
+
+  // the same answers as a std::set from one thread
+  std::mt19937 mt(threads);
+  std::uniform_int_distribution<int> dist(0, num);
+  for (std::size_t i = 0; i != num; ++i) {
+    int x = dist(mt), y = -1;
+    if (i % 3 == 0) assert(rbti.erase(x) == si.erase(x));
+    else if (i % 3 == 1) assert(rbti.emplace(x) == si.insert(x).second);
+    else assert(rbti.insert(x) == si.insert(x).second);
+    assert(rbti.is_valid_rb_tree());
+    auto lb = si.lower_bound(x / 2);
+    assert(rbti.lower_bound(x / 2, y) == (lb != si.end()));
+    if (lb != si.end()) assert(y == *lb);
+    auto ub = si.upper_bound(x / 2);
+    assert(rbti.upper_bound(x / 2, y) == (ub != si.end()));
+    if (ub != si.end()) assert(y == *ub);
+  }
+  assert(rbti.size() == si.size());
+  rbti.clear();
+  assert(rbti.empty() && !rbti.contains(0));
+}
+
+void testRCU(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  // every write keeps x and -x-1 together, readers check they never see
+  // half a write
+  RBTreeRCU<int> rcu;
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  for (int t = 0; t != 3; ++t) {
+    readers.emplace_back([&rcu, &done] {
+      while (!done.load()) {
+        auto r = rcu.read();
+        assert(r->size() % 2 == 0);
+        for (auto x : *r) assert(r->contains(-x - 1));
+        assert(r->is_valid_rb_tree());
+      }
+    });
+  }
+  std::set<int> si;
+  for (std::size_t i = 0; i != num; ++i) {
+    int x = dist(mt);
+    if (i % 3 == 2) {
+      rcu.write([x](RBTreePersistent<int> &t) {t.erase(x); t.erase(-x - 1);});
+      si.erase(x);
+      si.erase(-x - 1);
+    } else {
+      rcu.write([x](RBTreePersistent<int> &t) {
+        t.insert(x);
+        t.insert(-x - 1);
+      });
+      si.insert(x);
+      si.insert(-x - 1);
+    }
+  }
+  done.store(true);
+  for (auto &r : readers) r.join();
+
+  // a reader keeps its version across writes
+  {
+    auto r = rcu.read();
+    for (auto x : si) assert(rcu.erase(x) == 1);
+    assert(rcu.empty());
+    assert(rcu.insert(1));
+    assert(std::equal(si.begin(), si.end(), r->begin(), r->end()));
+  }
+  rcu.synchronize();
+  int y = 0;
+  assert(rcu.find(1, y) && y == 1);
+  assert(rcu.size() == 1 && rcu.count(1) == 1);
+  rcu.clear();
+  assert(rcu.empty());
+}
+
+void testSharded(std::size_t num)
+{
+  const int threads = 4;
+  RBTreeSharded<int> rbti(8);
+  std::vector<std::thread> workers;
+  // writer t owns the values equal to t modulo threads; ascending keys
+  // pile up in the last shard and force rebalancing
+  for (int t = 0; t != threads; ++t) {
+    workers.emplace_back([&rbti, t, num] {
+      for (int i = 0; i < static_cast<int>(num); ++i) {
+        int x = i * threads + t;
+        assert(rbti.insert(x));
+        assert(!rbti.emplace(x));
+        assert(rbti.contains(x));
+        int y = -1;
+        if (i % 3 == 0) assert(rbti.erase(x) == 1);
+        else assert(rbti.lower_bound(x, y) && y == x);
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+
+  std::set<int> si;
+  for (int x = 0; x != static_cast<int>(num) * threads; ++x)
+    if (x / threads % 3) si.insert(x);
+  assert(rbti.size() == si.size());
+  auto copy = rbti.snapshot();
+  assert(copy.is_valid_rb_tree());
+  assert(std::equal(si.begin(), si.end(), copy.begin(), copy.end()));
+  if (si.size() >= 2 * RBTreeSharded<int>::min_shard_size)
+    assert(rbti.shard_count() > 1);
+
+  for (int i = 0; i != static_cast<int>(num); ++i) {
+    int x = i * 7 % (static_cast<int>(num) * threads + 2) - 1;
+    int y = -1;
+    auto lb = si.lower_bound(x);
+    assert(rbti.lower_bound(x, y) == (lb != si.end()));
+    if (lb != si.end()) assert(y == *lb);
+    auto ub = si.upper_bound(x);
+    assert(rbti.upper_bound(x, y) == (ub != si.end()));
+    if (ub != si.end()) assert(y == *ub);
+    assert(rbti.find(x, y) == (si.count(x) != 0));
+  }
+
+  rbti.rebalance();
+  std::vector<int> in_order;
+  rbti.for_each([&in_order](int x) {in_order.push_back(x);});
+  assert(std::equal(si.begin(), si.end(), in_order.begin(), in_order.end()));
+  RBTreeSharded<int> built(si.begin(), si.end(), 3);
+  assert(built.size() == si.size());
+  assert(built.snapshot().size() == si.size());
+  rbti.clear();
+  assert(rbti.empty() && !rbti.contains(1));
+}
+
+void testBatch(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTree<int> rbti;
+  std::set<int> si;
+  for (std::size_t round = 0; round != 20; ++round) {
+    // clustered around a few centres, with repeats inside and across sides
+    std::vector<int> inserts, erases;
+    int centre = dist(mt);
+    for (std::size_t i = 0; i != num / 4; ++i) {
+      inserts.push_back(centre + dist(mt) % 64);
+      erases.push_back(i % 2 ? dist(mt) : centre + dist(mt) % 64);
+    }
+    if (round % 5 == 4) erases.assign(si.begin(), si.end());
+
+    std::vector<bool> erased, inserted;
+    for (auto x : erases) erased.push_back(si.erase(x) != 0);
+    for (auto x : inserts) inserted.push_back(si.insert(x).second);
+    auto result = rbti.apply_batch(inserts, erases);
+    assert(result.erased == erased);
+    assert(result.inserted == inserted);
+    check_validity(si, rbti);
+  }
+  auto result = rbti.apply_batch(std::vector<int>(), std::set<int>(si));
+  assert(std::count(result.erased.begin(), result.erased.end(), true)
+         == static_cast<std::ptrdiff_t>(si.size()));
+  si.clear();
+  check_validity(si, rbti);
+}
+
+void testCopy(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num * 400);
+  RBTreeThreadPool pool(3);
+
+  std::set<int> si;
+  RBTree<int> rbti;
+  for (std::size_t n : {std::size_t(0), std::size_t(1), num, num * 40}) {
+    while (si.size() < n) {
+      int x = dist(mt);
+      si.insert(x);
+      rbti.insert(x);
+    }
+    RBTree<int> copy(rbti);
+    check_validity(si, copy);
+    RBTree<int> cloned = rbti.clone(pool);
+    check_validity(si, cloned);
+    copy = cloned;
+    check_validity(si, copy);
+  }
+
+  // the pool allocator reserves the whole copy up front
+  RBTree<int, std::less<int>, RBTreePoolAllocator<int>> pooled(
+      si.begin(), si.end());
+  auto pooled_copy(pooled);
+  check_validity(si, pooled_copy);
+  auto pooled_clone = pooled.clone(pool);
+  check_validity(si, pooled_clone);
+
+  // a copy that throws half way frees what it built
+  RBTree<Fragile> fragile;
+  for (int i = 0; i != static_cast<int>(num) * 40; ++i) fragile.emplace(i);
+  for (int left : {0, static_cast<int>(num), static_cast<int>(num) * 20}) {
+    bool thrown = false;
+    Fragile::copies_left = left;
+    try {
+      RBTree<Fragile> copy(fragile);
+    } catch (const std::bad_alloc &) {
+      thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    Fragile::copies_left = left;
+    try {
+      fragile.clone(pool);
+    } catch (const std::bad_alloc &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+  Fragile::copies_left = std::numeric_limits<int>::max();
+  assert(fragile.clone(pool).size() == fragile.size());
+
+  // also with every node reserved up front by the pool allocator
+  RBTree<Fragile, std::less<Fragile>, RBTreePoolAllocator<Fragile>>
+    pooled_fragile;
+  for (int i = 0; i != static_cast<int>(num) * 40; ++i)
+    pooled_fragile.emplace(i);
+  for (int left : {0, static_cast<int>(num), static_cast<int>(num) * 20}) {
+    bool thrown = false;
+    Fragile::copies_left = left;
+    try {
+      pooled_fragile.clone(pool);
+    } catch (const std::bad_alloc &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+  Fragile::copies_left = std::numeric_limits<int>::max();
+  auto pooled_fragile_clone = pooled_fragile.clone(pool);
+  assert(pooled_fragile_clone.size() == pooled_fragile.size());
+  assert(pooled_fragile_clone.is_valid_rb_tree());
+}
+
+void testRangeErase(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num * 4);
+
+  RBTree<int> rbti;
+  std::set<int> si;
+  for (std::size_t round = 0; round != 40; ++round) {
+    while (si.size() < num) {
+      int x = dist(mt);
+      si.insert(x);
+      rbti.insert(x);
+    }
+    // short and long ranges, running to end() every few rounds
+    std::size_t start = dist(mt) % si.size();
+    std::size_t len = round % 2 ? dist(mt) % 16 : dist(mt) % (si.size() / 2);
+    if (round % 4 == 3 || len > si.size() - start) len = si.size() - start;
+    auto first = std::next(rbti.begin(), start);
+    auto last = std::next(first, len);
+    auto next = rbti.erase(first, last);
+    auto sfirst = std::next(si.begin(), start);
+    auto snext = si.erase(sfirst, std::next(sfirst, len));
+    assert(snext == si.end() ? next == rbti.end() : *next == *snext);
+    check_validity(si, rbti);
+  }
+  rbti.erase(rbti.begin(), rbti.end());
+  si.clear();
+  check_validity(si, rbti);
+}
+
+// no default constructor
+struct NoDefault {
+  explicit NoDefault(int key) : key(key) {}
+  bool operator<(const NoDefault &other) const {return key < other.key;}
+  int key;
+};
+
+void testFrozen(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num * 4);
+
+  // every shape of the last level, then bigger ones
+  RBTree<int> rbti;
+  std::set<int> si;
+  for (std::size_t n = 0; n <= num; n += n < 40 ? 1 : num / 4) {
+    while (si.size() < n) {
+      int x = dist(mt);
+      si.insert(x);
+      rbti.insert(x);
+    }
+    auto frozen = rbti.freeze();
+    assert(frozen.size() == si.size());
+    assert(frozen.empty() == si.empty());
+    assert(std::equal(si.begin(), si.end(), frozen.begin()));
+    assert(std::equal(si.rbegin(), si.rend(), frozen.rbegin()));
+    for (int x = -1; x <= static_cast<int>(num) * 4 + 1; ++x) {
+      auto it = frozen.find(x);
+      assert(si.count(x) ? *it == x : it == frozen.end());
+      assert(frozen.contains(x) == (si.count(x) != 0));
+      auto lower = frozen.lower_bound(x);
+      auto slower = si.lower_bound(x);
+      assert(slower == si.end() ? lower == frozen.end() : *lower == *slower);
+      auto upper = frozen.upper_bound(x);
+      auto supper = si.upper_bound(x);
+      assert(supper == si.end() ? upper == frozen.end() : *upper == *supper);
+      auto range = frozen.equal_range(x);
+      assert(range.first == lower && range.second == upper);
+    }
+    auto thawed = frozen.thaw();
+    check_validity(si, thawed);
+  }
+
+  // another order, and a key with no default constructor
+  RBTree<int, std::greater<int>> descending(si.begin(), si.end());
+  auto frozen = descending.freeze();
+  assert(std::equal(si.rbegin(), si.rend(), frozen.begin()));
+  for (int x : si) {
+    assert(frozen.lower_bound(x) == frozen.find(x));
+    assert(frozen.upper_bound(x) == std::next(frozen.find(x)));
+  }
+  std::vector<NoDefault> keys;
+  for (int x : si) keys.emplace_back(x);
+  RBTreeFrozen<NoDefault> frozen_keys(sorted_unique, keys.begin(), keys.end());
+  for (int x : si) assert(frozen_keys.find(NoDefault(x))->key == x);
+}
+
+struct ByFirst {
+  bool operator()(const std::pair<int, int> &lhs,
+                  const std::pair<int, int> &rhs) const {
+    return lhs.first < rhs.first;
+  }
+};
+
+void testBuffered(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num);
+
+  RBTreeBuffered<int, std::less<int>, std::allocator<int>, RBTreeNoAugment,
+                 16> rbti;
+  std::set<int> si;
+  for (std::size_t i = 0; i != num * 4; ++i) {
+    int x = dist(mt);
+    switch (i % 8) {
+    case 0:
+      assert(rbti.erase(x) == si.erase(x));
+      break;
+    case 1:
+      assert(rbti.contains(x) == (si.count(x) != 0));
+      break;
+    case 2: {
+      auto it = rbti.find(x);
+      assert(si.count(x) ? *it == x : it == rbti.end());
+      break;
+    }
+    case 3: {
+      auto it = rbti.lower_bound(x);
+      auto its = si.lower_bound(x);
+      assert(its == si.end() ? it == rbti.end() : *it == *its);
+      break;
+    }
+    case 4:
+      rbti.defer(x);
+      si.insert(x);
+      break;
+    default:
+      assert(rbti.insert(x) == si.insert(x).second);
+    }
+    assert(rbti.buffered() < 16);
+  }
+  auto merged = rbti.tree();
+  assert(!rbti.buffered());
+  check_validity(si, merged);
+  assert(std::equal(si.begin(), si.end(), rbti.begin()));
+
+  // the value inserted first stays, in the tree or the buffer
+  RBTreeBuffered<std::pair<int, int>, ByFirst> first;
+  first.insert({1, 0});
+  first.merge();
+  first.defer({1, -2});
+  for (int i = 1; i != 4; ++i) {
+    assert(!first.insert({1, i}));
+    assert(first.emplace(2, i) == (i == 1));
+  }
+  assert(first.find({1, -1})->second == 0);
+  assert(first.find({2, -1})->second == 1);
+  assert(first.size() == 2);
+
+  // sorted inserts into a tree that already holds some of them
+  RBTree<int> sorted;
+  std::vector<int> values;
+  for (int x = 0; x != static_cast<int>(num) * 4; ++x) {
+    if (x % 3 == 0) sorted.insert(x);
+    if (x % 2 == 0) values.push_back(x);
+  }
+  sorted.insert(sorted_unique, values.begin(), values.end());
+  for (int x = 0; x != static_cast<int>(num) * 4; ++x)
+    assert(sorted.contains(x) == (x % 3 == 0 || x % 2 == 0));
+  assert(sorted.check_parent() && sorted.is_valid_rb_tree());
+}
+
+void testFindMany(std::size_t num)
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  std::uniform_int_distribution<int> dist(0, num * 16);
+
+  RBTree<int> rbti;
+  std::vector<RBTree<int>::const_iterator> found;
+  std::vector<bool> contained;
+  for (std::size_t n : {std::size_t(0), std::size_t(1), num, num * 8}) {
+    while (rbti.size() < n) rbti.insert(dist(mt) * 4);
+    // a group count that does not divide evenly, hits and misses
+    std::vector<int> keys;
+    for (std::size_t i = 0; i != num + 7; ++i)
+      keys.push_back(i % 3 ? dist(mt) * 4 : dist(mt));
+    found.assign(keys.size(), rbti.end());
+    contained.clear();
+    assert(rbti.find_many(keys.begin(), keys.end(), found.begin())
+           == found.end());
+    rbti.contains_many(keys.begin(), keys.end(),
+                       std::back_inserter(contained));
+    assert(contained.size() == keys.size());
+    for (std::size_t i = 0; i != keys.size(); ++i) {
+      assert(found[i] == rbti.find(keys[i]));
+      assert(contained[i] == rbti.contains(keys[i]));
+    }
+  }
+  std::vector<int> none;
+  assert(rbti.find_many(none.begin(), none.end(), found.begin())
+         == found.begin());
+}
+
 template <typename T>
 std::size_t benchmark(std::size_t num) {
   T rbti;
@@ -317,6 +1656,21 @@ void benchmark() {
          << result / static_cast<double>(num) / log2(num) << " "
          << result / static_cast<double>(num) / num << " "
          << endl;
+    result = benchmark<RBTree<int, std::less<int>, 
+                              RBTreePoolAllocator<int>>>(num);
+    cout << "\tpool " 
+         << result << "us "
+         << result / static_cast<double>(num) << " "
+         << result / static_cast<double>(num) / log2(num) << " "
+         << result / static_cast<double>(num) / num << " "
+         << endl;
+    result = benchmark<RBTreeCompact<int>>(num);
+    cout << "\tcompact " 
+         << result << "us "
+         << result / static_cast<double>(num) << " "
+         << result / static_cast<double>(num) / log2(num) << " "
+         << result / static_cast<double>(num) / num << " "
+         << endl;
   }
 }
 
@@ -338,6 +1692,14 @@ void benchmark_insertion() {
       std::chrono::microseconds>
       (end-beg).count();
 
+    std::vector<int> sorted(si.begin(), si.end());
+    beg = std::chrono::high_resolution_clock::now();
+    RBTree<int> rbtisorted(sorted_unique, sorted.begin(), sorted.end());
+    end = std::chrono::high_resolution_clock::now();
+    double resultsorted = std::chrono::duration_cast<
+      std::chrono::microseconds>
+      (end-beg).count();
+
     cout << num << " " << si.size() << std::endl;
 
     cout << "\t"
@@ -357,6 +1719,54 @@ void benchmark_insertion() {
     cout << "\t\tmultiplier ";
     cout << resultrbti/resultsi;
     cout << endl;
+    cout << "\tsorted " << resultsorted << "us" << endl;
+  }
+}
+
+template <typename T>
+std::pair<double, long long> benchmark_iteration(const T &container) {
+  long long sum = 0;
+  auto beg = std::chrono::high_resolution_clock::now();
+  for (const auto &x : container) sum += x;
+  auto end = std::chrono::high_resolution_clock::now();
+  return {std::chrono::duration_cast<std::chrono::microseconds>
+    (end-beg).count(), sum};
+}
+
+void benchmark_iteration() {
+  for (std::size_t num = 1000; num < 50000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    RBTree<int> rbti(seq.begin(), seq.end());
+    std::set<int> si(seq.begin(), seq.end());
+    auto resultrbti = benchmark_iteration(rbti);
+    auto resultsi = benchmark_iteration(si);
+    assert(resultrbti.second == resultsi.second);
+    cout << num << " scan\t" << resultrbti.first << "us "
+         << resultsi.first << "us" << endl;
+  }
+}
+
+// fold a small delta into a large base
+void benchmark_merge() {
+  for (std::size_t num = 16000; num < 200000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    auto delta = generate_random_vector<int>(num / 64);
+    RBTree<int> base(seq.begin(), seq.end());
+    RBTree<int> small(delta.begin(), delta.end());
+    RBTree<int> base2(base);
+    auto beg = std::chrono::high_resolution_clock::now();
+    base.merge(small);
+    auto end = std::chrono::high_resolution_clock::now();
+    double merged = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    base2.insert(delta.begin(), delta.end());
+    end = std::chrono::high_resolution_clock::now();
+    double inserted = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(base.size() == base2.size());
+    cout << num << " merge " << num / 64 << "\t" << merged << "us "
+         << inserted << "us" << endl;
   }
 }
 
@@ -443,6 +1853,253 @@ std::pair<std::vector<typename T::iterator>,
   return {std::move(rtn1), std::move(rtn2)};
 }
 
+void benchmark_batch() {
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  for (std::size_t num = 16000; num < 200000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    // a batch of num / 8 updates clustered in 1/16th of the key range
+    std::uniform_int_distribution<int> dist(0, num / 16);
+    std::vector<int> inserts, erases;
+    for (std::size_t i = 0; i != num / 16; ++i) {
+      inserts.push_back(dist(mt));
+      erases.push_back(dist(mt));
+    }
+    // copies on both sides, for the same node layout
+    RBTree<int> base(seq.begin(), seq.end());
+    RBTree<int> batched(base), single(base);
+    auto beg = std::chrono::high_resolution_clock::now();
+    batched.apply_batch(inserts, erases);
+    auto end = std::chrono::high_resolution_clock::now();
+    double batch = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    for (auto x : erases) single.erase(x);
+    for (auto x : inserts) single.insert(x);
+    end = std::chrono::high_resolution_clock::now();
+    double one_by_one = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(batched.size() == single.size());
+    cout << num << " batch " << num / 8 << "\t" << batch << "us "
+         << one_by_one << "us" << endl;
+  }
+}
+
+void benchmark_copy() {
+  RBTreeThreadPool pool;
+  for (std::size_t num = 16000; num < 1000000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    RBTree<int> base(seq.begin(), seq.end());
+    auto beg = std::chrono::high_resolution_clock::now();
+    RBTree<int> copy(base);
+    auto end = std::chrono::high_resolution_clock::now();
+    double serial = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    RBTree<int> cloned = base.clone(pool);
+    end = std::chrono::high_resolution_clock::now();
+    double parallel = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(copy.size() == cloned.size());
+    cout << num << " copy\t" << serial << "us clone " << parallel << "us"
+         << endl;
+  }
+}
+
+// erasing a range of k at once against one element at a time
+void benchmark_range_erase() {
+  std::size_t num = 100000 * multiplier;
+  auto seq = generate_random_vector<int>(num);
+  RBTree<int> base(seq.begin(), seq.end());
+  for (std::size_t k = 16; k < base.size() / 2; k *= 8) {
+    RBTree<int> ranged(base), looped(base);
+    auto beg = std::chrono::high_resolution_clock::now();
+    auto first = ranged.nth(ranged.size() / 4);
+    ranged.erase(first, std::next(first, k));
+    auto end = std::chrono::high_resolution_clock::now();
+    double at_once = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    first = looped.nth(looped.size() / 4);
+    for (std::size_t i = 0; i != k; ++i) first = looped.erase(first);
+    end = std::chrono::high_resolution_clock::now();
+    double one_by_one = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    cout << k << " range erase\t" << at_once << "us one by one "
+         << one_by_one << "us" << endl;
+  }
+}
+
+// random lookups in a tree and in its frozen copy
+void benchmark_frozen() {
+  for (std::size_t num = 1000; num < 2000000*multiplier; num *= 8) {
+    auto seq = generate_random_vector<int>(num);
+    RBTree<int> rbti(seq.begin(), seq.end());
+    auto frozen = rbti.freeze();
+    auto keys = generate_random_vector<int>(1000000);
+    std::size_t found = 0;
+    auto beg = std::chrono::high_resolution_clock::now();
+    for (int x : keys) found += rbti.contains(x);
+    auto end = std::chrono::high_resolution_clock::now();
+    double tree = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    for (int x : keys) found -= frozen.contains(x);
+    end = std::chrono::high_resolution_clock::now();
+    double flat = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(!found);
+    cout << num << " lookups\t" << tree << "us frozen " << flat << "us"
+         << endl;
+  }
+}
+
+// random inserts one at a time, and through RBTreeBuffered unchecked and
+// checked
+void benchmark_buffered() {
+  for (std::size_t num = 16000; num < 1000000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    for (auto &x : seq) x *= 1024;
+    RBTree<int> rbti;
+    RBTreeBuffered<int> buffered;
+    auto beg = std::chrono::high_resolution_clock::now();
+    for (int x : seq) rbti.insert(x);
+    auto end = std::chrono::high_resolution_clock::now();
+    double one_by_one = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    for (int x : seq) buffered.defer(x);
+    buffered.merge();
+    end = std::chrono::high_resolution_clock::now();
+    double merged = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(rbti.size() == buffered.size());
+    RBTreeBuffered<int> checked;
+    beg = std::chrono::high_resolution_clock::now();
+    for (int x : seq) checked.insert(x);
+    checked.merge();
+    end = std::chrono::high_resolution_clock::now();
+    double searched = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    assert(rbti.size() == checked.size());
+    cout << num << " inserts\t" << one_by_one << "us deferred " << merged
+         << "us checked " << searched << "us" << endl;
+  }
+}
+
+// a million random lookups one by one and with find_many
+void benchmark_find_many() {
+  for (std::size_t num = 16000; num < 2000000*multiplier; num *= 8) {
+    auto seq = generate_random_vector<int>(num);
+    RBTree<int> rbti(seq.begin(), seq.end());
+    auto keys = generate_random_vector<int>(1000000);
+    std::vector<RBTree<int>::const_iterator> found(keys.size());
+    auto beg = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i != keys.size(); ++i)
+      found[i] = rbti.find(keys[i]);
+    auto end = std::chrono::high_resolution_clock::now();
+    double one_by_one = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    rbti.find_many(keys.begin(), keys.end(), found.begin());
+    end = std::chrono::high_resolution_clock::now();
+    double lockstep = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    cout << num << " find\t" << one_by_one << "us find_many " << lockstep
+         << "us" << endl;
+  }
+}
+
+void benchmark_clear() {
+  for (std::size_t num = 16000; num < 1000000*multiplier; num *= 4) {
+    auto seq = generate_random_vector<int>(num);
+    RBTree<int> plain(seq.begin(), seq.end());
+    RBTree<int, std::less<int>, RBTreePoolAllocator<int>> pooled(
+        seq.begin(), seq.end());
+    auto beg = std::chrono::high_resolution_clock::now();
+    plain.clear();
+    auto end = std::chrono::high_resolution_clock::now();
+    double one_by_one = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    beg = std::chrono::high_resolution_clock::now();
+    pooled.clear();
+    end = std::chrono::high_resolution_clock::now();
+    double released = std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count();
+    cout << num << " clear\t" << one_by_one << "us pool " << released
+         << "us" << endl;
+  }
+}
+
+// ops/us of a mix with writes percent inserts, the rest lookups: one
+// mutex around RBTree, RBTreeConcurrent, RBTreeRCU and RBTreeSharded
+template <typename Set, typename Find, typename Insert>
+double concurrent_throughput(Set &set, int threads, std::size_t ops,
+                             Find find, Insert insert,
+                             std::size_t writes = 10) {
+  std::vector<std::thread> workers;
+  // counting the hits keeps the lookups from being optimized away
+  std::atomic<std::size_t> found {0};
+  auto beg = std::chrono::high_resolution_clock::now();
+  for (int t = 0; t != threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::mt19937 mt(t);
+      std::uniform_int_distribution<int> dist(0, ops);
+      std::size_t hits = 0;
+      for (std::size_t i = 0; i != ops / threads; ++i) {
+        if (i % 100 >= writes) hits += find(set, dist(mt));
+        else insert(set, dist(mt));
+      }
+      found += hits;
+    });
+  }
+  for (auto &w : workers) w.join();
+  auto end = std::chrono::high_resolution_clock::now();
+  return ops / static_cast<double>(std::chrono::duration_cast<
+      std::chrono::microseconds>(end-beg).count() + 1);
+}
+
+void benchmark_concurrent() {
+  struct Locked {
+    RBTree<int> tree;
+    std::mutex lock;
+  };
+  std::size_t ops = 200000 * multiplier;
+  for (std::size_t writes : {10, 50}) {
+    for (int threads = 1; threads <= 16; threads *= 2) {
+      auto seq = generate_random_vector<int>(ops);
+      Locked locked;
+      locked.tree.insert(seq.begin(), seq.end());
+      double mutexed = concurrent_throughput(locked, threads, ops,
+          [](Locked &l, int x) {
+            std::lock_guard<std::mutex> lock(l.lock);
+            return l.tree.contains(x);
+          },
+          [](Locked &l, int x) {
+            std::lock_guard<std::mutex> lock(l.lock);
+            l.tree.insert(x);
+          }, writes);
+      RBTreeConcurrent<int> concurrent(seq.begin(), seq.end());
+      double parallel = concurrent_throughput(concurrent, threads, ops,
+          [](RBTreeConcurrent<int> &c, int x) {return c.contains(x);},
+          [](RBTreeConcurrent<int> &c, int x) {c.insert(x);}, writes);
+      RBTreeRCU<int> rcu(RBTreePersistent<int>(seq.begin(), seq.end()));
+      double epoch = concurrent_throughput(rcu, threads, ops,
+          [](RBTreeRCU<int> &r, int x) {return r.contains(x);},
+          [](RBTreeRCU<int> &r, int x) {r.insert(x);}, writes);
+      RBTreeSharded<int> sharded(seq.begin(), seq.end(), 8);
+      double ranged = concurrent_throughput(sharded, threads, ops,
+          [](RBTreeSharded<int> &r, int x) {return r.contains(x);},
+          [](RBTreeSharded<int> &r, int x) {r.insert(x);}, writes);
+      cout << writes << "% writes, " << threads << " threads mutex "
+           << mutexed << " ops/us, "
+           << "concurrent " << parallel << " ops/us, "
+           << "rcu " << epoch << " ops/us, "
+           << "sharded " << ranged << " ops/us" << endl;
+    }
+  }
+}
+
 template <typename T>
 void remove_duplicate(T &c)
 {
@@ -547,7 +2204,7 @@ void testRandomRemoval(std::size_t num) {
     } else {
       auto it = rbti.begin();
       //for (auto it = rbti.begin(); it != rbti.end(); ++it) {
-      //  std::cout << it.lock() << std::endl << " " << *it << std::endl;
+      //  std::cout << it.node() << std::endl << " " << *it << std::endl;
       //}
       std::advance(it, dist(mt)%rbti.size());
       x = *it + dist(mt) % 2;
@@ -639,9 +2296,40 @@ int main(int argc, char **argv)
   testIterator();
   testRandomInsertion(100*multiplier);
   testRandomRemoval(400*multiplier);
+  testBounds(400*multiplier);
+  testHintedInsertion(400*multiplier);
+  testSortedConstruction(100*multiplier);
+  testMoveInsertion(100*multiplier);
+  testOrderStatistics(400*multiplier);
+  testAugment(400*multiplier);
+  testIntervalTree(400*multiplier);
+  testSetAlgebra(400*multiplier);
+  testBatch(400*multiplier);
+  testRangeErase(400*multiplier);
+  testFrozen(400*multiplier);
+  testBuffered(400*multiplier);
+  testFindMany(400*multiplier);
+  testCopy(400*multiplier);
+  testParallelSetAlgebra(100*multiplier);
+  testPoolAllocator(400*multiplier);
+  testCompact(400*multiplier);
+  testPersistent(100*multiplier);
+  testConcurrent(400*multiplier);
+  testRCU(100*multiplier);
+  testSharded(400*multiplier);
   benchmark();
   benchmark_insertion();
   benchmark_removal();
+  benchmark_iteration();
+  benchmark_merge();
+  benchmark_batch();
+  benchmark_copy();
+  benchmark_clear();
+  benchmark_range_erase();
+  benchmark_frozen();
+  benchmark_buffered();
+  benchmark_find_many();
+  benchmark_concurrent();
   output();
   return 0;
 }